@@ -15,8 +15,10 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <ifaddrs.h>
+#include <linux/filter.h>
 #include <linux/if_ether.h>
 #include <linux/if_packet.h>
+#include <linux/neighbour.h>
 #include <linux/rtnetlink.h>
 #include <netdb.h>
 #include <net/if_arp.h>
@@ -27,9 +29,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/timerfd.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef HAVE_LIBCAP
@@ -55,6 +60,20 @@
 
 #define FINAL_PACKS		2
 
+#define SWEEP_BATCH		64	/* probes per sendmmsg() */
+#define SWEEP_PPS_DEFAULT	10000
+#define SWEEP_MAX_BITS		20	/* at most a /12 */
+#define MAX_HALEN		8	/* hardware address bytes kept for sweeps, stations and bursts */
+#define SWEEP_FRAME		(sizeof(struct arphdr) + 2 * (MAX_HALEN + 4))
+
+#define GARP_ROUNDS		16	/* at most in a -R schedule */
+
+#define MONITOR_CONFLICT	10	/* secs a mac counts as still in use */
+#define MONITOR_BLOCK		(1 << 16)	/* receive ring block size */
+#define MONITOR_BLOCKS		16
+#define MONITOR_FRAME		2048
+#define MONITOR_RETIRE_MS	100	/* hand partly filled blocks over after */
+
 
 struct device {
 	char *name;
@@ -62,6 +81,94 @@ struct device {
 	struct ifaddrs *ifa;
 };
 
+/*
+ * Entries of an array found by address through open addressing over their
+ * indices, so a lookup costs the same for a /30 and a /16.  The entries
+ * start with their struct in_addr.
+ */
+struct addr_index {
+	uint32_t *slot;			/* entry index + 1, 0 for a free slot */
+	uint32_t mask;
+};
+
+/* An address probed in sweep mode. */
+struct sweep_host {
+	struct in_addr ip;
+	unsigned char mac[MAX_HALEN];	/* of the first reply */
+	struct timespec sent;		/* last probe */
+	long rtt;			/* usecs to the first reply, -1 for none */
+	int replies;
+	int nud;			/* neighbour table state with -N, 0 if not installed */
+	unsigned int dup:1;		/* replies came from another mac too */
+};
+
+/* Sweep mode state.  The hosts are kept in the order given. */
+struct sweep {
+	struct sweep_host *host;
+	size_t nhosts;
+	size_t alloc;
+	struct addr_index index;
+	unsigned int pps;
+	int round;
+	int rounds;
+	size_t next;			/* host to probe next in this round */
+	size_t round_sent;
+	struct timespec round_start;
+	struct timespec round_end;	/* zero while the round is sending */
+	size_t answered;
+	size_t duplicates;
+	struct sweep_host *fresh;	/* answering for the first time with the packet at hand */
+};
+
+/* A gratuitous ARP of the burst mode, ready to send. */
+struct garp {
+	struct sockaddr_ll to;
+	unsigned char frame[SWEEP_FRAME];
+	int len;
+};
+
+/*
+ * Burst mode state: the packets for all (address, interface) pairs, sent
+ * in rounds at the offsets of the schedule, at most pps a second.
+ */
+struct garp_burst {
+	struct garp *garp;
+	size_t ngarps;
+	size_t alloc;
+	int ifaces;
+	long sched[GARP_ROUNDS];	/* msecs from the start */
+	int rounds;
+};
+
+/* An address seen in monitor mode, as a sender of ARP packets. */
+struct station {
+	struct in_addr ip;
+	unsigned char mac[MAX_HALEN];
+	unsigned char other[MAX_HALEN];	/* the mac before, or the one in conflict */
+	struct timespec first;		/* with mac */
+	struct timespec last;
+	struct timespec other_last;
+	unsigned long count;
+	unsigned int changes;
+	unsigned int conflict:1;	/* other is in use at the same time */
+};
+
+/*
+ * Monitor mode state.  Stations are found by address as the sweep hosts
+ * are, packets come in through a TPACKET_V3 receive ring, so a burst of
+ * them costs one wakeup per ring block instead of one recvfrom() each.
+ */
+struct monitor {
+	struct station *station;
+	size_t nstations;
+	size_t alloc;
+	struct addr_index index;
+	unsigned char *ring;
+	struct timespec now;		/* of the packet at hand */
+	size_t conflicts;
+	size_t flaps;
+};
+
 struct run_state {
 	struct device device;
 	char *source;
@@ -83,8 +190,12 @@ struct run_state {
 	int received;
 	int brd_recv;
 	int req_recv;
+	struct sweep sweep;
+	struct monitor monitor;
+	struct garp_burst burst;
 #ifdef HAVE_LIBCAP
 	cap_flag_value_t cap_raw;
+	cap_flag_value_t cap_admin;	/* for -N */
 #else
 	uid_t euid;
 #endif
@@ -92,14 +203,18 @@ struct run_state {
 		advert:1,
 		broadcast_only:1,
 		dad:1,
+		monitoring:1,
+		neighbours:1,
 		quiet:1,
 		quit_on_reply:1,
+		sweeping:1,
 		unicasting:1,
 		unsolicited:1;
 };
 
 #ifdef HAVE_LIBCAP
 static const cap_value_t caps[] = { CAP_NET_RAW };
+static const cap_value_t neigh_caps[] = { CAP_NET_ADMIN };
 #endif
 
 /*
@@ -122,6 +237,9 @@ static void usage(void)
 	fprintf(stderr, _(
 		"\nUsage:\n"
 		"  arping [options] <destination>\n"
+		"  arping [options] -S <destination>...\n"
+		"  arping [options] -m\n"
+		"  arping [options] -g <file>\n"
 		"\nOptions:\n"
 		"  -f            quit on first reply\n"
 		"  -q            be quiet\n"
@@ -133,6 +251,13 @@ static void usage(void)
 		"  -c <count>    how many packets to send\n"
 		"  -w <timeout>  how long to wait for a reply\n"
 		"  -i <interval> set interval between packets (default: 1 second)\n"
+		"  -S            sweep all given addresses and prefixes, - reads them from stdin,\n"
+		"                or check them all for duplicates with -D\n"
+		"  -r <rate>     packets per second with -S and -g (default: 10000)\n"
+		"  -N            sweep and install the answers in the neighbour table\n"
+		"  -m            watch ARP traffic for new stations, mac changes and conflicts\n"
+		"  -g <file>     send gratuitous ARP for the address and interface pairs in <file>\n"
+		"  -R <ms,...>   send the -g burst again at these offsets (default: 0)\n"
 		"  -I <device>   which ethernet device to use"
 	));
 #ifdef DEFAULT_DEVICE_STR
@@ -157,12 +282,16 @@ static void limit_capabilities(struct run_state *ctl)
 		error(-1, errno, "cap_get_proc");
 
 	cap_get_flag(cap_p, CAP_NET_RAW, CAP_PERMITTED, &ctl->cap_raw);
+	cap_get_flag(cap_p, CAP_NET_ADMIN, CAP_PERMITTED, &ctl->cap_admin);
 
 	if (ctl->cap_raw != CAP_CLEAR) {
 		if (cap_clear(cap_p) < 0)
 			error(-1, errno, "cap_clear");
 
 		cap_set_flag(cap_p, CAP_PERMITTED, 1, caps, CAP_SET);
+		/* Options are not parsed yet, -N may need it. */
+		if (ctl->cap_admin == CAP_SET)
+			cap_set_flag(cap_p, CAP_PERMITTED, 1, neigh_caps, CAP_SET);
 
 		if (cap_set_proc(cap_p) < 0) {
 			error(0, errno, "cap_set_proc");
@@ -203,13 +332,25 @@ static int modify_capability_raw(struct run_state *ctl, int on)
 	return 0;
 }
 
-static void drop_capabilities(void)
+/* Whether -N will be able to install neighbours after drop_capabilities(). */
+static int neigh_capable(struct run_state *ctl)
+{
+	return ctl->cap_admin == CAP_SET;
+}
+
+static void drop_capabilities(struct run_state *ctl)
 {
 	cap_t cap_p = cap_init();
 
 	if (!cap_p)
 		error(-1, errno, "cap_init");
 
+	/* Neighbours are installed all through the sweep. */
+	if (ctl->neighbours && neigh_capable(ctl)) {
+		cap_set_flag(cap_p, CAP_PERMITTED, 1, neigh_caps, CAP_SET);
+		cap_set_flag(cap_p, CAP_EFFECTIVE, 1, neigh_caps, CAP_SET);
+	}
+
 	if (cap_set_proc(cap_p) < 0)
 		error(-1, errno, "cap_set_proc");
 
@@ -228,7 +369,12 @@ static int modify_capability_raw(struct run_state *ctl, int on)
 	return 0;
 }
 
-static void drop_capabilities(void)
+static int neigh_capable(struct run_state *ctl __attribute__((__unused__)))
+{
+	return !getuid();
+}
+
+static void drop_capabilities(struct run_state *ctl __attribute__((__unused__)))
 {
 	if (setuid(getuid()) < 0)
 		error(-1, errno, "setuid");
@@ -245,15 +391,12 @@ static inline int disable_capability_raw(struct run_state *ctl)
 	return modify_capability_raw(ctl, 0);
 }
 
-static int send_pack(struct run_state *ctl)
+/* Build the ARP packet from src at ME for dst at HE in buf, returning its length. */
+static int build_pack(struct run_state *ctl, unsigned char *buf, struct sockaddr_ll const *ME,
+		      struct sockaddr_ll const *HE, struct in_addr src, struct in_addr dst)
 {
-	int err;
-	struct timespec now;
-	unsigned char buf[256];
 	struct arphdr *ah = (struct arphdr *)buf;
 	unsigned char *p = (unsigned char *)(ah + 1);
-	struct sockaddr_ll *ME = (struct sockaddr_ll *)&(ctl->me);
-	struct sockaddr_ll *HE = (struct sockaddr_ll *)&(ctl->he);
 
 	ah->ar_hrd = htons(ME->sll_hatype);
 	if (ah->ar_hrd == htons(ARPHRD_FDDI))
@@ -276,7 +419,7 @@ static int send_pack(struct run_state *ctl)
 	memcpy(p, &ME->sll_addr, ah->ar_hln);
 	p += ME->sll_halen;
 
-	memcpy(p, &ctl->gsrc, 4);
+	memcpy(p, &src, 4);
 	p += 4;
 
 	if (ctl->advert)
@@ -285,12 +428,23 @@ static int send_pack(struct run_state *ctl)
 		memcpy(p, &HE->sll_addr, ah->ar_hln);
 	p += ah->ar_hln;
 
-	memcpy(p, &ctl->gdst, 4);
+	memcpy(p, &dst, 4);
 	p += 4;
 
+	return p - buf;
+}
+
+static int send_pack(struct run_state *ctl)
+{
+	int err;
+	struct timespec now;
+	unsigned char buf[256];
+	struct sockaddr_ll *HE = (struct sockaddr_ll *)&(ctl->he);
+	int len = build_pack(ctl, buf, (struct sockaddr_ll *)&ctl->me, HE, ctl->gsrc, ctl->gdst);
+
 	clock_gettime(CLOCK_MONOTONIC, &now);
-	err = sendto(ctl->socketfd, buf, p - buf, 0, (struct sockaddr *)HE, sll_len(ah->ar_hln));
-	if (err == p - buf) {
+	err = sendto(ctl->socketfd, buf, len, 0, (struct sockaddr *)HE, sll_len(HE->sll_halen));
+	if (err == len) {
 		ctl->last = now;
 		ctl->sent++;
 		if (!ctl->unicasting)
@@ -335,6 +489,333 @@ static void print_hex(unsigned char *p, int len)
 	}
 }
 
+static uint32_t addr_hash(struct in_addr ip)
+{
+	uint32_t h = ntohl(ip.s_addr) * 2654435761U;
+
+	return h ^ h >> 16;
+}
+
+static struct in_addr addr_entry(void const *base, size_t size, size_t idx)
+{
+	return *(struct in_addr const *)((char const *)base + idx * size);
+}
+
+/* The index of the entry of base with address ip, -1 if there is none. */
+static long addr_index_find(struct addr_index const *ix, void const *base, size_t size,
+			    struct in_addr ip)
+{
+	uint32_t i;
+
+	if (!ix->slot)
+		return -1;
+	for (i = addr_hash(ip) & ix->mask; ix->slot[i]; i = (i + 1) & ix->mask)
+		if (addr_entry(base, size, ix->slot[i] - 1).s_addr == ip.s_addr)
+			return ix->slot[i] - 1;
+	return -1;
+}
+
+static void addr_index_insert(struct addr_index *ix, void const *base, size_t size, size_t idx)
+{
+	uint32_t i;
+
+	for (i = addr_hash(addr_entry(base, size, idx)) & ix->mask; ix->slot[i];
+	     i = (i + 1) & ix->mask)
+		;
+	ix->slot[i] = idx + 1;
+}
+
+/* Index entry idx of base, which follows the ones indexed already. */
+static void addr_index_add(struct addr_index *ix, void const *base, size_t size, size_t idx)
+{
+	size_t i;
+
+	/* Kept at most half full, so probe sequences stay short. */
+	if ((idx + 1) * 2 > (size_t)ix->mask + 1 || !ix->slot) {
+		free(ix->slot);
+		ix->mask = ix->slot ? ix->mask * 2 + 1 : 1023;
+		ix->slot = calloc((size_t)ix->mask + 1, sizeof(*ix->slot));
+		if (!ix->slot)
+			error(2, errno, "calloc");
+		for (i = 0; i < idx; i++)
+			addr_index_insert(ix, base, size, i);
+	}
+	addr_index_insert(ix, base, size, idx);
+}
+
+static struct sweep_host *sweep_find(struct sweep const *sw, struct in_addr ip)
+{
+	long i = addr_index_find(&sw->index, sw->host, sizeof(*sw->host), ip);
+
+	return i < 0 ? NULL : &sw->host[i];
+}
+
+static void sweep_add(struct sweep *sw, struct in_addr ip)
+{
+	struct sweep_host *h;
+
+	if (sweep_find(sw, ip))
+		return;
+	if (sw->nhosts == 1U << SWEEP_MAX_BITS)
+		error(2, 0, _("too many addresses to sweep, at most %u"), 1U << SWEEP_MAX_BITS);
+	if (sw->nhosts == sw->alloc) {
+		sw->alloc = sw->alloc ? sw->alloc * 2 : 256;
+		sw->host = realloc(sw->host, sw->alloc * sizeof(*sw->host));
+		if (!sw->host)
+			error(2, errno, "realloc");
+	}
+	h = &sw->host[sw->nhosts];
+	memset(h, 0, sizeof(*h));
+	h->ip = ip;
+	h->rtt = -1;
+	addr_index_add(&sw->index, sw->host, sizeof(*sw->host), sw->nhosts++);
+}
+
+/* Add an address or all addresses of a prefix, network and broadcast aside. */
+static void sweep_parse(struct sweep *sw, char *arg)
+{
+	char *slash = strchr(arg, '/');
+	struct in_addr ip;
+	uint32_t mask, first, last, a;
+	int len = 32;
+
+	if (slash) {
+		*slash = '\0';
+		len = strtol_or_err(slash + 1, _("invalid prefix length"), 32 - SWEEP_MAX_BITS, 32);
+	}
+	if (inet_aton(arg, &ip) != 1)
+		error(2, 0, _("invalid address: %s"), arg);
+	mask = len ? 0xffffffffU << (32 - len) : 0;
+	first = ntohl(ip.s_addr) & mask;
+	last = first | ~mask;
+	if (len < 31) {
+		first++;
+		last--;
+	}
+	for (a = first;; a++) {
+		ip.s_addr = htonl(a);
+		sweep_add(sw, ip);
+		if (a == last)
+			break;
+	}
+}
+
+static void sweep_read(struct sweep *sw, FILE *f)
+{
+	char *line = NULL;
+	size_t n = 0;
+
+	while (getline(&line, &n, f) != -1) {
+		char *tok, *save;
+
+		line[strcspn(line, "#")] = '\0';
+		for (tok = strtok_r(line, " \t\r\n", &save); tok; tok = strtok_r(NULL, " \t\r\n", &save))
+			sweep_parse(sw, tok);
+	}
+	free(line);
+}
+
+/*
+ * Send up to n probes of the current round, in batches of SWEEP_BATCH.
+ * Hosts that answered in an earlier round are passed over.
+ */
+static void sweep_send(struct run_state *ctl, size_t n)
+{
+	struct sweep *sw = &ctl->sweep;
+	struct sockaddr_ll *HE = (struct sockaddr_ll *)&ctl->he;
+	unsigned char frame[SWEEP_BATCH][SWEEP_FRAME];
+	struct iovec iov[SWEEP_BATCH];
+	struct mmsghdr msg[SWEEP_BATCH];
+	struct sweep_host *batch[SWEEP_BATCH];
+	struct timespec now;
+
+	while (n) {
+		unsigned int cnt = 0;
+		int i, sent;
+
+		while (cnt < SWEEP_BATCH && cnt < n && sw->next < sw->nhosts) {
+			struct sweep_host *h = &sw->host[sw->next++];
+
+			if (h->replies)
+				continue;
+			iov[cnt].iov_base = frame[cnt];
+			iov[cnt].iov_len = build_pack(ctl, frame[cnt], (struct sockaddr_ll *)&ctl->me,
+						      HE, ctl->gsrc, h->ip);
+			memset(&msg[cnt], 0, sizeof(msg[cnt]));
+			msg[cnt].msg_hdr.msg_name = HE;
+			msg[cnt].msg_hdr.msg_namelen = sll_len(HE->sll_halen);
+			msg[cnt].msg_hdr.msg_iov = &iov[cnt];
+			msg[cnt].msg_hdr.msg_iovlen = 1;
+			batch[cnt++] = h;
+		}
+		if (!cnt)
+			return;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		sent = sendmmsg(ctl->socketfd, msg, cnt, 0);
+		if (sent < 0) {
+			if (errno != ENOBUFS && errno != EAGAIN)
+				error(0, errno, "sendmmsg");
+			sent = 0;
+		}
+		for (i = 0; i < sent; i++)
+			batch[i]->sent = now;
+		ctl->sent += sent;
+		ctl->brd_sent += sent;
+		sw->round_sent += sent;
+		if ((unsigned int)sent < cnt) {
+			/* The device queue is full, the rest goes on the next tick. */
+			sw->next = batch[sent] - sw->host;
+			return;
+		}
+		n -= cnt;
+	}
+}
+
+static int sweep_reply(struct run_state *ctl, struct sockaddr_ll *FROM, struct arphdr *ah,
+		       struct in_addr src_ip, struct timespec const *ts)
+{
+	struct sweep *sw = &ctl->sweep;
+	unsigned char *sha = (unsigned char *)(ah + 1);
+	struct sweep_host *h = sweep_find(sw, src_ip);
+
+	if (!h)
+		return 0;
+	if (!h->replies) {
+		memcpy(h->mac, sha, ah->ar_hln);
+		if (h->sent.tv_sec || h->sent.tv_nsec)
+			h->rtt = (ts->tv_sec - h->sent.tv_sec) * 1000000 +
+				 (ts->tv_nsec - h->sent.tv_nsec) / 1000;
+		sw->answered++;
+		sw->fresh = h;
+	} else if (memcmp(h->mac, sha, ah->ar_hln)) {
+		if (!h->dup)
+			sw->duplicates++;
+		h->dup = 1;
+	} else {
+		/* The same station answering a retry. */
+		h->replies++;
+		ctl->received++;
+		return 1;
+	}
+	if (!ctl->quiet) {
+		printf("%s ", FROM->sll_pkttype == PACKET_HOST ? _("Unicast") : _("Broadcast"));
+		printf(_("%s from "), ah->ar_op == htons(ARPOP_REPLY) ? _("reply") : _("request"));
+		printf("%s [", inet_ntoa(src_ip));
+		print_hex(sha, ah->ar_hln);
+		printf("]");
+		if (h->replies) {
+			printf(_(" DUP! first ["));
+			print_hex(h->mac, ah->ar_hln);
+			printf("]\n");
+		} else if (h->rtt >= 0)
+			printf(_(" %ld.%03ldms\n"), h->rtt / 1000, h->rtt % 1000);
+		else
+			printf(_(" UNSOLICITED?\n"));
+		fflush(stdout);
+	}
+	h->replies++;
+	ctl->received++;
+	if (FROM->sll_pkttype != PACKET_HOST)
+		ctl->brd_recv++;
+	if (ah->ar_op == htons(ARPOP_REQUEST))
+		ctl->req_recv++;
+	return 1;
+}
+
+static struct station *station_find(struct monitor const *mon, struct in_addr ip)
+{
+	long i = addr_index_find(&mon->index, mon->station, sizeof(*mon->station), ip);
+
+	return i < 0 ? NULL : &mon->station[i];
+}
+
+static struct station *station_add(struct monitor *mon, struct in_addr ip)
+{
+	struct station *st;
+
+	if (mon->nstations == mon->alloc) {
+		mon->alloc = mon->alloc ? mon->alloc * 2 : 256;
+		mon->station = realloc(mon->station, mon->alloc * sizeof(*mon->station));
+		if (!mon->station)
+			error(2, errno, "realloc");
+	}
+	st = &mon->station[mon->nstations];
+	memset(st, 0, sizeof(*st));
+	st->ip = ip;
+	addr_index_add(&mon->index, mon->station, sizeof(*mon->station), mon->nstations++);
+	return st;
+}
+
+static void print_event(struct run_state *ctl, char const *what, struct station const *st,
+			unsigned char const *mac, int halen)
+{
+	if (ctl->quiet)
+		return;
+	printf("[%ld.%06ld] %s %s [", (long)ctl->monitor.now.tv_sec,
+	       ctl->monitor.now.tv_nsec / 1000, what, inet_ntoa(st->ip));
+	print_hex((unsigned char *)st->mac, halen);
+	printf("]");
+	if (mac) {
+		printf(" [");
+		print_hex((unsigned char *)mac, halen);
+		printf("]");
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+/*
+ * Account an ARP packet sent by ip from mac.  Another mac for a known
+ * address is a conflict while the one known was heard from in the last
+ * MONITOR_CONFLICT seconds, and a flap, the address having moved, if not.
+ */
+static int monitor_packet(struct run_state *ctl, unsigned char const *mac, int halen,
+			  struct in_addr ip)
+{
+	struct monitor *mon = &ctl->monitor;
+	struct station *st;
+
+	/* Probes of duplicate address detection, nobody's address yet. */
+	if (!ip.s_addr)
+		return 0;
+	st = station_find(mon, ip);
+	if (!st) {
+		st = station_add(mon, ip);
+		memcpy(st->mac, mac, halen);
+		st->first = mon->now;
+		print_event(ctl, _("new"), st, NULL, halen);
+	} else if (!memcmp(st->mac, mac, halen)) {
+		if (st->conflict && mon->now.tv_sec - st->other_last.tv_sec > MONITOR_CONFLICT)
+			st->conflict = 0;
+	} else if (st->conflict && !memcmp(st->other, mac, halen) &&
+		   mon->now.tv_sec - st->last.tv_sec <= MONITOR_CONFLICT) {
+		/* Still both in use, once the first one went silent it is a flap. */
+		st->other_last = mon->now;
+		st->count++;
+		return 1;
+	} else if (mon->now.tv_sec - st->last.tv_sec <= MONITOR_CONFLICT) {
+		memcpy(st->other, mac, halen);
+		st->other_last = mon->now;
+		if (!st->conflict)
+			mon->conflicts++;
+		st->conflict = 1;
+		print_event(ctl, _("conflict"), st, mac, halen);
+		st->count++;
+		return 1;
+	} else {
+		print_event(ctl, _("flap"), st, mac, halen);
+		memcpy(st->other, st->mac, halen);
+		memcpy(st->mac, mac, halen);
+		st->first = mon->now;
+		st->conflict = 0;
+		st->changes++;
+		mon->flaps++;
+	}
+	st->last = mon->now;
+	st->count++;
+	return 1;
+}
+
 static int recv_pack(struct run_state *ctl, unsigned char *buf, ssize_t len,
 		     struct sockaddr_ll *FROM)
 {
@@ -345,10 +826,11 @@ static int recv_pack(struct run_state *ctl, unsigned char *buf, ssize_t len,
 
 	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	/* Filter out wild packets */
+	/* Filter out wild packets, the monitor sees the others' too */
 	if (FROM->sll_pkttype != PACKET_HOST &&
 	    FROM->sll_pkttype != PACKET_BROADCAST &&
-	    FROM->sll_pkttype != PACKET_MULTICAST)
+	    FROM->sll_pkttype != PACKET_MULTICAST &&
+	    (FROM->sll_pkttype != PACKET_OTHERHOST || !ctl->monitoring))
 		return 0;
 
 	/* Only these types are recognised */
@@ -380,6 +862,23 @@ static int recv_pack(struct run_state *ctl, unsigned char *buf, ssize_t len,
 		return 0;
 	memcpy(&src_ip, p + ah->ar_hln, 4);
 	memcpy(&dst_ip, p + ah->ar_hln + 4 + ah->ar_hln, 4);
+	if (ctl->monitoring)
+		return monitor_packet(ctl, p, ah->ar_hln, src_ip);
+	if (ctl->sweeping) {
+		/* As below, the sender is looked up among all the targets. */
+		if (ctl->dad) {
+			if (!memcmp(p, ((struct sockaddr_ll *)&ctl->me)->sll_addr, ah->ar_hln))
+				return 0;
+			if (ctl->gsrc.s_addr && ctl->gsrc.s_addr != dst_ip.s_addr)
+				return 0;
+		} else {
+			if (ctl->gsrc.s_addr != dst_ip.s_addr)
+				return 0;
+			if (memcmp(p + ah->ar_hln + 4, ((struct sockaddr_ll *)&ctl->me)->sll_addr, ah->ar_hln))
+				return 0;
+		}
+		return sweep_reply(ctl, FROM, ah, src_ip, &ts);
+	}
 	if (!ctl->dad) {
 		if (src_ip.s_addr != ctl->gdst.s_addr)
 			return 0;
@@ -482,8 +981,27 @@ static int outgoing_device(struct run_state *const ctl, struct nlmsghdr *nh)
 	return 0;
 }
 
-static void netlink_query(struct run_state *const ctl, const int flags,
-			  const int type, void const *const arg, size_t len)
+/* The state of the neighbour just looked up, for neigh_install(). */
+static int neigh_state(struct run_state *const ctl, struct nlmsghdr *nh)
+{
+	struct ndmsg *ndm = NLMSG_DATA(nh);
+
+	if (nh->nlmsg_type != RTM_NEWNEIGH) {
+		error(0, 0, "NETLINK new neighbour message type");
+		return 1;
+	}
+	ctl->sweep.fresh->nud = ndm->ndm_state;
+	return 0;
+}
+
+/*
+ * Handle each reply of a netlink request with reply().  Requests with
+ * NLM_F_ACK get no reply but the acknowledgement.  Returns nonzero on
+ * errors, which are reported.
+ */
+static int netlink_query(struct run_state *const ctl, const int flags,
+			  const int type, void const *const arg, size_t len,
+			  int (*reply)(struct run_state *const, struct nlmsghdr *))
 {
 	const size_t buffer_size = 4096;
 	int fd;
@@ -531,6 +1049,13 @@ static void netlink_query(struct run_state *const ctl, const int flags,
 			continue;
 		switch (nh->nlmsg_type) {
 		case NLMSG_ERROR:
+			if (!((struct nlmsgerr *)NLMSG_DATA(nh))->error) {
+				ret = 0;
+				break;
+			}
+			errno = -((struct nlmsgerr *)NLMSG_DATA(nh))->error;
+			error(0, errno, "NETLINK_ROUTE");
+			goto fail;
 		case NLMSG_OVERRUN:
 			errno = EIO;
 			error(0, 0, "NETLINK_ROUTE unexpected iov element");
@@ -539,7 +1064,7 @@ static void netlink_query(struct run_state *const ctl, const int flags,
 			ret = 0;
 			break;
 		default:
-			ret = outgoing_device(ctl, nh);
+			ret = reply(ctl, nh);
 			break;
 		}
 	}
@@ -547,8 +1072,7 @@ static void netlink_query(struct run_state *const ctl, const int flags,
 	free(unmodified_nh);
 	if (0 <= fd)
 		close(fd);
-	if (ret)
-		exit(1);
+	return ret;
 }
 
 static void guess_device(struct run_state *const ctl)
@@ -577,7 +1101,68 @@ static void guess_device(struct run_state *const ctl)
 	query.ra.rta_type = RTA_DST;
 	memcpy(RTA_DATA(&query.ra), &ctl->gdst, addr_len);
 	len = NLMSG_ALIGN(sizeof(struct rtmsg)) + RTA_LENGTH(addr_len);
-	netlink_query(ctl, NLM_F_REQUEST, RTM_GETROUTE, &query, len);
+	if (netlink_query(ctl, NLM_F_REQUEST, RTM_GETROUTE, &query, len, outgoing_device))
+		exit(1);
+}
+
+/*
+ * Enter the answer of a sweep host in the neighbour table as reachable,
+ * and read back the state the kernel keeps for it.  A host that could not
+ * be entered is left as not installed, the sweep goes on.
+ */
+static void neigh_install(struct run_state *const ctl, struct sweep_host *h)
+{
+	int halen = ((struct sockaddr_ll *)&ctl->me)->sll_halen;
+	struct {
+		struct ndmsg ndm;
+		struct rtattr dst;
+		struct in_addr ip;
+		struct rtattr lladdr;
+		unsigned char mac[sizeof(h->mac)];	/* halen of them, checked in main() */
+	} query = { {0}, {0}, {0}, {0}, {0} };
+
+	query.ndm.ndm_family = AF_INET;
+	query.ndm.ndm_ifindex = ctl->device.ifindex;
+	query.ndm.ndm_state = NUD_REACHABLE;
+	query.dst.rta_len = RTA_LENGTH(sizeof(query.ip));
+	query.dst.rta_type = NDA_DST;
+	query.ip = h->ip;
+	query.lladdr.rta_len = RTA_LENGTH(halen);
+	query.lladdr.rta_type = NDA_LLADDR;
+	memcpy(query.mac, h->mac, halen);
+	if (netlink_query(ctl, NLM_F_REQUEST | NLM_F_CREATE | NLM_F_REPLACE | NLM_F_ACK,
+			  RTM_NEWNEIGH, &query, NLMSG_ALIGN(sizeof(struct ndmsg)) +
+			  RTA_LENGTH(sizeof(query.ip)) + RTA_LENGTH(halen), NULL))
+		return;
+
+	ctl->sweep.fresh = h;
+	query.ndm.ndm_state = 0;
+	netlink_query(ctl, NLM_F_REQUEST, RTM_GETNEIGH, &query,
+		      NLMSG_ALIGN(sizeof(struct ndmsg)) + RTA_LENGTH(sizeof(query.ip)), neigh_state);
+}
+
+static char const *nud_name(int nud)
+{
+	switch (nud) {
+	case NUD_INCOMPLETE:
+		return "INCOMPLETE";
+	case NUD_REACHABLE:
+		return "REACHABLE";
+	case NUD_STALE:
+		return "STALE";
+	case NUD_DELAY:
+		return "DELAY";
+	case NUD_PROBE:
+		return "PROBE";
+	case NUD_FAILED:
+		return "FAILED";
+	case NUD_NOARP:
+		return "NOARP";
+	case NUD_PERMANENT:
+		return "PERMANENT";
+	default:
+		return "NONE";
+	}
 }
 
 /* Common check for ifa->ifa_flags */
@@ -856,6 +1441,614 @@ static int event_loop(struct run_state *ctl)
 	return rc;
 }
 
+/*
+ * The host that stands for all of them in the route and source address
+ * lookups: the first one that is not an address of our own, which would
+ * route to the loopback device.
+ */
+static struct in_addr sweep_stand_in(struct sweep const *sw)
+{
+	struct ifaddrs *ifa0, *ifa;
+	size_t i;
+
+	if (getifaddrs(&ifa0))
+		error(2, errno, "getifaddrs");
+	for (i = 0; i < sw->nhosts; i++) {
+		for (ifa = ifa0; ifa; ifa = ifa->ifa_next) {
+			if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_INET &&
+			    ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr.s_addr == sw->host[i].ip.s_addr)
+				break;
+		}
+		if (!ifa)
+			break;
+	}
+	freeifaddrs(ifa0);
+	if (i == sw->nhosts)
+		error(2, 0, _("no address to sweep that is not our own"));
+	return sw->host[i].ip;
+}
+
+/*
+ * Have the kernel drop the ARP packets recv_pack() would throw away, which
+ * on a busy segment is nearly all of them: other hosts' traffic, our own
+ * probes, and packets for other addresses.  Only the header fields that do
+ * not depend on the hardware type are checked here, recv_pack() still does
+ * all of its checks.
+ */
+static void attach_filter(struct run_state const *ctl)
+{
+	enum { DROP = 0xff };	/* jump placeholder, to the last instruction */
+	int hln = ((struct sockaddr_ll const *)&ctl->me)->sll_halen;
+	struct sock_filter code[16];
+	struct sock_fprog prog = { .filter = code };
+	int n = 0, i;
+
+	/* PACKET_HOST, PACKET_BROADCAST and PACKET_MULTICAST, the monitor all but ours */
+	code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE);
+	if (ctl->monitoring)
+		code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, PACKET_OTHERHOST, DROP, 0);
+	else
+		code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, PACKET_MULTICAST, DROP, 0);
+	/* ar_hln and ar_pln */
+	code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, offsetof(struct arphdr, ar_hln));
+	code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, hln << 8 | 4, 0, DROP);
+	code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, offsetof(struct arphdr, ar_op));
+	code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ARPOP_REQUEST, 1, 0);
+	code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ARPOP_REPLY, 0, DROP);
+	/* The sender is the target, but for a sweep. */
+	if (!ctl->sweeping && !ctl->monitoring) {
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, sizeof(struct arphdr) + hln);
+		code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(ctl->gdst.s_addr), 0, DROP);
+	}
+	/* The target is us, but for DAD without a source address. */
+	if ((!ctl->dad || ctl->gsrc.s_addr) && !ctl->monitoring) {
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, sizeof(struct arphdr) + 2 * hln + 4);
+		code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(ctl->gsrc.s_addr), 0, DROP);
+	}
+	code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+	code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+	for (i = 0; i < n; i++) {
+		if (code[i].jt == DROP)
+			code[i].jt = n - 2 - i;
+		if (code[i].jf == DROP)
+			code[i].jf = n - 2 - i;
+	}
+	prog.len = n;
+	if (setsockopt(ctl->socketfd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1)
+		error(0, errno, _("WARNING: setsockopt(SO_ATTACH_FILTER)"));
+}
+
+static long timespec_ms(struct timespec const *a, struct timespec const *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000 + (a->tv_nsec - b->tv_nsec) / 1000000;
+}
+
+/*
+ * Probe all hosts of the sweep at sw->pps, in -c rounds -i seconds apart
+ * that only go to the hosts still silent, and wait -w seconds after the
+ * last one.
+ */
+static int sweep_loop(struct run_state *ctl)
+{
+	struct sweep *sw = &ctl->sweep;
+	enum {
+		POLLFD_SIGNAL = 0,
+		POLLFD_TIMER,
+		POLLFD_SOCKET,
+		POLLFD_COUNT
+	};
+	struct pollfd pfds[POLLFD_COUNT];
+	long tick = 1000000000L / sw->pps;
+	struct itimerspec timerfd_vals;
+	struct timespec start, now;
+	unsigned char packet[4096];
+	struct signalfd_siginfo sigval;
+	sigset_t mask;
+	int exit_loop = 0, rc = 0;
+	long wait = ctl->timeout ? ctl->timeout * 1000L : 1000;
+	long ms;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGQUIT);
+	sigaddset(&mask, SIGTERM);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+		error(0, errno, "sigprocmask failed");
+		return 1;
+	}
+	pfds[POLLFD_SIGNAL].fd = signalfd(-1, &mask, 0);
+	if (pfds[POLLFD_SIGNAL].fd == -1) {
+		error(0, errno, "signalfd");
+		return 1;
+	}
+	pfds[POLLFD_SIGNAL].events = POLLIN | POLLERR | POLLHUP;
+
+	/* Paced by the clock rather than by the ticks, which may be late. */
+	if (tick < 1000000)
+		tick = 1000000;
+	timerfd_vals.it_interval.tv_sec = tick / 1000000000;
+	timerfd_vals.it_interval.tv_nsec = tick % 1000000000;
+	timerfd_vals.it_value = timerfd_vals.it_interval;
+	pfds[POLLFD_TIMER].fd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (pfds[POLLFD_TIMER].fd == -1) {
+		error(0, errno, "timerfd_create failed");
+		return 1;
+	}
+	if (timerfd_settime(pfds[POLLFD_TIMER].fd, 0, &timerfd_vals, NULL)) {
+		error(0, errno, "timerfd_settime failed");
+		return 1;
+	}
+	pfds[POLLFD_TIMER].events = POLLIN | POLLERR | POLLHUP;
+
+	pfds[POLLFD_SOCKET].fd = ctl->socketfd;
+	pfds[POLLFD_SOCKET].events = POLLIN | POLLERR | POLLHUP;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	sw->round = 1;
+	sw->round_start = start;
+
+	while (!exit_loop) {
+		uint64_t exp;
+		ssize_t s;
+
+		if (poll(pfds, POLLFD_COUNT, -1) <= 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			error(0, errno, "poll failed");
+			break;
+		}
+		if (pfds[POLLFD_SIGNAL].revents) {
+			s = read(pfds[POLLFD_SIGNAL].fd, &sigval, sizeof(sigval));
+			if (s == sizeof(sigval))
+				exit_loop = 1;
+		}
+		while (pfds[POLLFD_SOCKET].revents) {
+			struct sockaddr_storage from = { 0 };
+			socklen_t addr_len = sizeof(from);
+
+			s = recvfrom(ctl->socketfd, packet, sizeof(packet), MSG_DONTWAIT,
+				     (struct sockaddr *)&from, &addr_len);
+			if (s < 0) {
+				if (errno == EAGAIN)
+					break;
+				error(0, errno, "recvfrom");
+				if (errno == ENETDOWN) {
+					rc = 2;
+					exit_loop = 1;
+				}
+				break;
+			}
+			recv_pack(ctl, packet, s, (struct sockaddr_ll *)&from);
+			if (sw->fresh && ctl->neighbours)
+				neigh_install(ctl, sw->fresh);
+			sw->fresh = NULL;
+		}
+		if (!pfds[POLLFD_TIMER].revents)
+			continue;
+		if (read(pfds[POLLFD_TIMER].fd, &exp, sizeof(exp)) != sizeof(exp)) {
+			error(0, errno, "could not read timerfd");
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (sw->next < sw->nhosts) {
+			size_t due = (size_t)((now.tv_sec - sw->round_start.tv_sec) * sw->pps +
+				      (now.tv_nsec - sw->round_start.tv_nsec) /
+				      (1000000000L / sw->pps)) + 1;
+
+			if (due > sw->round_sent)
+				sweep_send(ctl, due - sw->round_sent);
+			if (sw->next == sw->nhosts)
+				sw->round_end = now;
+			continue;
+		}
+		ms = timespec_ms(&now, &sw->round_end);
+		if (sw->answered == sw->nhosts)
+			exit_loop = 1;
+		else if (sw->round < sw->rounds) {
+			if (ms >= (long)ctl->interval * 1000) {
+				sw->round++;
+				sw->next = 0;
+				sw->round_sent = 0;
+				sw->round_start = now;
+			}
+		} else if (ms >= wait)
+			exit_loop = 1;
+	}
+	close(pfds[POLLFD_SIGNAL].fd);
+	close(pfds[POLLFD_TIMER].fd);
+	freeifaddrs(ctl->ifa0);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = timespec_ms(&now, &start);
+	if (!ctl->quiet && ctl->dad) {
+		size_t i;
+
+		printf(_("Checked %zu addresses in %ld.%03lds with %d probes\n"), sw->nhosts,
+		       ms / 1000, ms % 1000, ctl->sent);
+		printf(_("%zu in use\n"), sw->answered);
+		for (i = 0; i < sw->nhosts; i++) {
+			struct sweep_host *h = &sw->host[i];
+
+			if (!h->replies)
+				continue;
+			printf(_("%s in use by ["), inet_ntoa(h->ip));
+			print_hex(h->mac, ((struct sockaddr_ll *)&ctl->me)->sll_halen);
+			printf(h->dup ? _("] and others\n") : "]\n");
+		}
+		fflush(stdout);
+	} else if (!ctl->quiet && ctl->neighbours) {
+		size_t i, reachable = 0;
+
+		for (i = 0; i < sw->nhosts; i++) {
+			struct sweep_host *h = &sw->host[i];
+
+			if (!h->replies) {
+				printf(_("%s no reply\n"), inet_ntoa(h->ip));
+				continue;
+			}
+			printf("%s [", inet_ntoa(h->ip));
+			print_hex(h->mac, ((struct sockaddr_ll *)&ctl->me)->sll_halen);
+			printf("] %s\n", nud_name(h->nud));
+			reachable += h->nud == NUD_REACHABLE;
+		}
+		printf(_("%zu of %zu neighbours reachable after %ld.%03lds\n"), reachable,
+		       sw->nhosts, ms / 1000, ms % 1000);
+		fflush(stdout);
+	} else if (!ctl->quiet) {
+		printf(_("Swept %zu addresses in %ld.%03lds with %d probes\n"), sw->nhosts,
+		       ms / 1000, ms % 1000, ctl->sent);
+		printf(_("%zu responded, %zu with duplicate replies\n"), sw->answered,
+		       sw->duplicates);
+		fflush(stdout);
+	}
+	if (rc)
+		return rc;
+	if (ctl->neighbours)
+		return sw->answered != sw->nhosts;
+	/* As with one address, DAD succeeds when nobody answers. */
+	return ctl->dad ? !!sw->answered : !sw->answered;
+}
+
+/* Add the gratuitous ARP for ip on the interface named ifname. */
+static void garp_add(struct run_state *ctl, struct in_addr ip, char const *ifname)
+{
+	struct garp_burst *gb = &ctl->burst;
+	struct sockaddr_ll *ME = NULL, *HE = NULL;
+	struct ifaddrs *ifa;
+	struct garp *g;
+	size_t i;
+
+	for (ifa = ctl->ifa0; ifa; ifa = ifa->ifa_next) {
+		if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_PACKET ||
+		    strcmp(ifa->ifa_name, ifname))
+			continue;
+		if (!(ifa->ifa_flags & IFF_UP))
+			error(2, 0, _("Interface \"%s\" is down"), ifname);
+		if (ifa->ifa_flags & (IFF_NOARP | IFF_LOOPBACK) || !ifa->ifa_broadaddr)
+			error(2, 0, _("Interface \"%s\" is not ARPable"), ifname);
+		ME = (struct sockaddr_ll *)ifa->ifa_addr;
+		HE = (struct sockaddr_ll *)ifa->ifa_broadaddr;
+		break;
+	}
+	if (!ME)
+		error(2, 0, _("Device %s not available."), ifname);
+	if (!ME->sll_halen || ME->sll_halen > MAX_HALEN)
+		error(2, 0, _("Interface \"%s\" is not ARPable (no ll address)"), ifname);
+
+	for (i = 0; i < gb->ngarps && gb->garp[i].to.sll_ifindex != ME->sll_ifindex; i++)
+		;
+	if (i == gb->ngarps)
+		gb->ifaces++;
+	if (gb->ngarps == gb->alloc) {
+		gb->alloc = gb->alloc ? gb->alloc * 2 : 64;
+		gb->garp = realloc(gb->garp, gb->alloc * sizeof(*gb->garp));
+		if (!gb->garp)
+			error(2, errno, "realloc");
+	}
+	g = &gb->garp[gb->ngarps++];
+	memset(&g->to, 0, sizeof(g->to));
+	g->to.sll_family = AF_PACKET;
+	g->to.sll_ifindex = ME->sll_ifindex;
+	g->to.sll_protocol = htons(ETH_P_ARP);
+	g->to.sll_halen = ME->sll_halen;
+	memcpy(g->to.sll_addr, HE->sll_addr, ME->sll_halen);
+	g->len = build_pack(ctl, g->frame, ME, HE, ip, ip);
+}
+
+/* Read "address [interface]" lines, the interface defaulting to -I. */
+static void garp_read(struct run_state *ctl, char const *path)
+{
+	FILE *f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	char *line = NULL;
+	size_t n = 0;
+
+	if (!f)
+		error(2, errno, "%s", path);
+	if (getifaddrs(&ctl->ifa0))
+		error(2, errno, "getifaddrs");
+	while (getline(&line, &n, f) != -1) {
+		char *addr, *ifname, *save;
+		struct in_addr ip;
+
+		line[strcspn(line, "#")] = '\0';
+		addr = strtok_r(line, " \t\r\n", &save);
+		if (!addr)
+			continue;
+		ifname = strtok_r(NULL, " \t\r\n", &save);
+		if (!ifname)
+			ifname = ctl->device.name;
+		if (!ifname)
+			error(2, 0, _("no interface for %s, please, use option -I"), addr);
+		if (inet_aton(addr, &ip) != 1)
+			error(2, 0, _("invalid address: %s"), addr);
+		garp_add(ctl, ip, ifname);
+	}
+	free(line);
+	if (f != stdin)
+		fclose(f);
+	freeifaddrs(ctl->ifa0);
+	if (!ctl->burst.ngarps)
+		error(2, 0, _("no addresses in %s"), path);
+}
+
+static void garp_schedule(struct garp_burst *gb, char *arg)
+{
+	char *tok, *save;
+
+	gb->rounds = 0;
+	for (tok = strtok_r(arg, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (gb->rounds == GARP_ROUNDS)
+			error(2, 0, _("at most %d rounds in a schedule"), GARP_ROUNDS);
+		gb->sched[gb->rounds] = strtol_or_err(tok, _("invalid schedule"),
+						      gb->rounds ? gb->sched[gb->rounds - 1] : 0,
+						      INT_MAX);
+		gb->rounds++;
+	}
+}
+
+static void timespec_add_ns(struct timespec *ts, long long ns)
+{
+	ns += ts->tv_nsec;
+	ts->tv_sec += ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+}
+
+/*
+ * Send the burst in all rounds of the schedule.  A round starts at its
+ * offset, or when the one before is done if that is later, and sends all
+ * packets in batches at most pps a second.
+ */
+static int garp_burst(struct run_state *ctl, unsigned int pps)
+{
+	struct garp_burst *gb = &ctl->burst;
+	struct iovec iov[SWEEP_BATCH];
+	struct mmsghdr msg[SWEEP_BATCH];
+	struct timespec start, round_start, at, now;
+	int r, rc = 0;
+	long ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (r = 0; r < gb->rounds; r++) {
+		size_t sent = 0;
+
+		at = start;
+		timespec_add_ns(&at, gb->sched[r] * 1000000LL);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL) == EINTR)
+			;
+		clock_gettime(CLOCK_MONOTONIC, &round_start);
+		while (sent < gb->ngarps) {
+			size_t due, cnt, i;
+			int n;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			due = (size_t)(((now.tv_sec - round_start.tv_sec) * 1000000000LL +
+					now.tv_nsec - round_start.tv_nsec) * pps / 1000000000LL) + 1;
+			if (due <= sent) {
+				/* Until the next one is due. */
+				at = round_start;
+				timespec_add_ns(&at, sent * 1000000000LL / pps);
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL);
+				continue;
+			}
+			cnt = MIN(MIN(due, gb->ngarps) - sent, SWEEP_BATCH);
+			for (i = 0; i < cnt; i++) {
+				struct garp *g = &gb->garp[sent + i];
+
+				iov[i].iov_base = g->frame;
+				iov[i].iov_len = g->len;
+				memset(&msg[i], 0, sizeof(msg[i]));
+				msg[i].msg_hdr.msg_name = &g->to;
+				msg[i].msg_hdr.msg_namelen = sll_len(g->to.sll_halen);
+				msg[i].msg_hdr.msg_iov = &iov[i];
+				msg[i].msg_hdr.msg_iovlen = 1;
+			}
+			n = sendmmsg(ctl->socketfd, msg, cnt, 0);
+			if (n < 0) {
+				if (errno == ENOBUFS || errno == EAGAIN)
+					continue;
+				/* Skip the one that failed, an interface may have gone down. */
+				error(0, errno, "sendmmsg");
+				rc = 2;
+				n = 1;
+			} else
+				ctl->sent += n;
+			sent += n;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (!ctl->quiet) {
+			ms = timespec_ms(&now, &start);
+			printf(_("Round %d done at %ld.%03lds, after %ldms\n"), r + 1,
+			       ms / 1000, ms % 1000, timespec_ms(&now, &round_start));
+		}
+	}
+	if (!ctl->quiet) {
+		ms = timespec_ms(&now, &start);
+		printf(_("Sent %d gratuitous ARP for %zu addresses on %d interfaces in %ld.%03lds\n"),
+		       ctl->sent, gb->ngarps, gb->ifaces, ms / 1000, ms % 1000);
+		fflush(stdout);
+	}
+	return rc;
+}
+
+/*
+ * Set up the monitor's receive ring, and see the unicast ARP between
+ * others too.  Done before capabilities are dropped.
+ */
+static void monitor_setup(struct run_state *ctl)
+{
+	int version = TPACKET_V3;
+	struct tpacket_req3 req = {
+		.tp_block_size = MONITOR_BLOCK,
+		.tp_block_nr = MONITOR_BLOCKS,
+		.tp_frame_size = MONITOR_FRAME,
+		.tp_frame_nr = MONITOR_BLOCK / MONITOR_FRAME * MONITOR_BLOCKS,
+		.tp_retire_blk_tov = MONITOR_RETIRE_MS,
+	};
+	struct packet_mreq mr = {
+		.mr_ifindex = ctl->device.ifindex,
+		.mr_type = PACKET_MR_PROMISC,
+	};
+
+	if (setsockopt(ctl->socketfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+		error(2, errno, "setsockopt(PACKET_VERSION)");
+	if (setsockopt(ctl->socketfd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1)
+		error(2, errno, "setsockopt(PACKET_RX_RING)");
+	ctl->monitor.ring = mmap(NULL, (size_t)MONITOR_BLOCK * MONITOR_BLOCKS,
+				 PROT_READ | PROT_WRITE, MAP_SHARED, ctl->socketfd, 0);
+	if (ctl->monitor.ring == MAP_FAILED)
+		error(2, errno, "mmap");
+	if (setsockopt(ctl->socketfd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr, sizeof(mr)) == -1)
+		error(0, errno, _("WARNING: cannot see unicast ARP between other hosts"));
+}
+
+static void print_wall(struct timespec const *ts)
+{
+	char buf[64];
+	time_t t = ts->tv_sec;
+
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	printf("%s", buf);
+}
+
+static void monitor_print(struct run_state *ctl, int halen)
+{
+	struct monitor *mon = &ctl->monitor;
+	size_t i;
+
+	printf(_("%zu stations, %zu conflicts, %zu flaps\n"), mon->nstations, mon->conflicts,
+	       mon->flaps);
+	for (i = 0; i < mon->nstations; i++) {
+		struct station *st = &mon->station[i];
+
+		printf("%-15s [", inet_ntoa(st->ip));
+		print_hex(st->mac, halen);
+		printf(_("] first "));
+		print_wall(&st->first);
+		printf(_(" last "));
+		print_wall(&st->last);
+		printf(_(" packets %lu"), st->count);
+		if (st->changes)
+			printf(_(" changes %u"), st->changes);
+		if (st->conflict) {
+			printf(_(" conflict ["));
+			print_hex(st->other, halen);
+			printf("]");
+		}
+		printf("\n");
+	}
+	fflush(stdout);
+}
+
+/*
+ * Watch ARP traffic until a signal or the -w deadline, printing the
+ * station table on SIGUSR1 and at the end.
+ */
+static int monitor_loop(struct run_state *ctl)
+{
+	struct monitor *mon = &ctl->monitor;
+	int halen = ((struct sockaddr_ll *)&ctl->me)->sll_halen;
+	enum {
+		POLLFD_SIGNAL = 0,
+		POLLFD_SOCKET,
+		POLLFD_COUNT
+	};
+	struct pollfd pfds[POLLFD_COUNT];
+	struct signalfd_siginfo sigval;
+	struct timespec start, now;
+	unsigned int block = 0;
+	sigset_t mask;
+	int exit_loop = 0;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGQUIT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+		error(0, errno, "sigprocmask failed");
+		return 2;
+	}
+	pfds[POLLFD_SIGNAL].fd = signalfd(-1, &mask, 0);
+	if (pfds[POLLFD_SIGNAL].fd == -1) {
+		error(0, errno, "signalfd");
+		return 2;
+	}
+	pfds[POLLFD_SIGNAL].events = POLLIN;
+	pfds[POLLFD_SOCKET].fd = ctl->socketfd;
+	pfds[POLLFD_SOCKET].events = POLLIN | POLLERR;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (!exit_loop) {
+		struct tpacket_block_desc *bd;
+		int timeout = -1;
+
+		if (ctl->timeout) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			timeout = ctl->timeout * 1000 - timespec_ms(&now, &start);
+			if (timeout <= 0)
+				break;
+		}
+		bd = (struct tpacket_block_desc *)(mon->ring + (size_t)block * MONITOR_BLOCK);
+		if (!(bd->hdr.bh1.block_status & TP_STATUS_USER)) {
+			if (poll(pfds, POLLFD_COUNT, timeout) < 0 && errno != EINTR) {
+				error(0, errno, "poll failed");
+				break;
+			}
+			if (pfds[POLLFD_SIGNAL].revents &&
+			    read(pfds[POLLFD_SIGNAL].fd, &sigval, sizeof(sigval)) == sizeof(sigval)) {
+				if (sigval.ssi_signo == SIGUSR1)
+					monitor_print(ctl, halen);
+				else
+					exit_loop = 1;
+			}
+			continue;
+		}
+		{
+			struct tpacket3_hdr *h = (struct tpacket3_hdr *)((unsigned char *)bd +
+					bd->hdr.bh1.offset_to_first_pkt);
+			uint32_t i;
+
+			for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+				struct sockaddr_ll *from = (struct sockaddr_ll *)((unsigned char *)h +
+						TPACKET_ALIGN(sizeof(*h)));
+
+				mon->now.tv_sec = h->tp_sec;
+				mon->now.tv_nsec = h->tp_nsec;
+				recv_pack(ctl, (unsigned char *)h + h->tp_mac, h->tp_snaplen, from);
+				h = (struct tpacket3_hdr *)((unsigned char *)h + h->tp_next_offset);
+			}
+		}
+		bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		block = (block + 1) % MONITOR_BLOCKS;
+	}
+	close(pfds[POLLFD_SIGNAL].fd);
+	freeifaddrs(ctl->ifa0);
+	if (!ctl->quiet)
+		monitor_print(ctl, halen);
+	return !!mon->conflicts;
+}
+
 int main(int argc, char **argv)
 {
 	struct run_state ctl = {
@@ -867,6 +2060,7 @@ int main(int argc, char **argv)
 #endif
 		0
 	};
+	char const *burst_file = NULL;
 	int ch;
 
 	atexit(close_stdout);
@@ -878,7 +2072,7 @@ int main(int argc, char **argv)
 	textdomain (PACKAGE_NAME);
 #endif
 #endif
-	while ((ch = getopt(argc, argv, "h?bfDUAqc:w:i:s:I:V")) != EOF) {
+	while ((ch = getopt(argc, argv, "h?bfDUAqc:w:g:i:mNr:R:s:SI:V")) != EOF) {
 		switch (ch) {
 		case 'b':
 			ctl.broadcast_only = 1;
@@ -909,6 +2103,25 @@ int main(int argc, char **argv)
 		case 'I':
 			ctl.device.name = optarg;
 			break;
+		case 'S':
+			ctl.sweeping = 1;
+			break;
+		case 'N':
+			ctl.sweeping = 1;
+			ctl.neighbours = 1;
+			break;
+		case 'm':
+			ctl.monitoring = 1;
+			break;
+		case 'g':
+			burst_file = optarg;
+			break;
+		case 'R':
+			garp_schedule(&ctl.burst, optarg);
+			break;
+		case 'r':
+			ctl.sweep.pps = strtol_or_err(optarg, _("invalid argument"), 1, 1000000);
+			break;
 		case 'f':
 			ctl.quit_on_reply = 1;
 			break;
@@ -928,8 +2141,18 @@ int main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (argc != 1)
+	if (burst_file ? argc != 0 : ctl.sweeping ? argc < 1 : argc != !ctl.monitoring)
 		usage();
+	if (burst_file && (ctl.sweeping || ctl.monitoring || ctl.dad))
+		error(2, 0, _("-g cannot be used with -S, -m or -D"));
+	if (ctl.monitoring && (ctl.sweeping || ctl.dad || ctl.unsolicited))
+		error(2, 0, _("-m cannot be used with -S, -D, -U or -A"));
+	if (ctl.sweeping && ctl.unsolicited)
+		error(2, 0, _("-S cannot be used with -U or -A"));
+	if (ctl.neighbours && ctl.dad)
+		error(2, 0, _("-N cannot be used with -D"));
+	if (ctl.neighbours && !neigh_capable(&ctl))
+		error(2, 0, _("-N needs the CAP_NET_ADMIN capability"));
 
 	enable_capability_raw(&ctl);
 	ctl.socketfd = socket(PF_PACKET, SOCK_DGRAM, 0);
@@ -937,12 +2160,37 @@ int main(int argc, char **argv)
 		error(2, errno, "socket");
 	disable_capability_raw(&ctl);
 
+	if (burst_file) {
+		garp_read(&ctl, burst_file);
+		if (!ctl.burst.rounds)
+			ctl.burst.rounds = 1;
+		drop_capabilities(&ctl);
+		return garp_burst(&ctl, ctl.sweep.pps ? ctl.sweep.pps : SWEEP_PPS_DEFAULT);
+	}
+
 	ctl.target = *argv;
 
 	if (ctl.device.name && !*ctl.device.name)
 		ctl.device.name = NULL;
 
-	if (inet_aton(ctl.target, &ctl.gdst) != 1) {
+	if (ctl.sweeping) {
+		for (; argc; argc--, argv++) {
+			if (strcmp(*argv, "-"))
+				sweep_parse(&ctl.sweep, *argv);
+			else
+				sweep_read(&ctl.sweep, stdin);
+		}
+		if (!ctl.sweep.nhosts)
+			error(2, 0, _("no addresses to sweep"));
+		if (!ctl.sweep.pps)
+			ctl.sweep.pps = SWEEP_PPS_DEFAULT;
+		ctl.sweep.rounds = ctl.count > 0 ? ctl.count : 1;
+		/* Addresses of our own may well be checked on a given device. */
+		ctl.gdst = ctl.device.name ? ctl.sweep.host[0].ip : sweep_stand_in(&ctl.sweep);
+		ctl.gdst_family = AF_INET;
+	} else if (ctl.monitoring)
+		/* Nothing to send, so no target */;
+	else if (inet_aton(ctl.target, &ctl.gdst) != 1) {
 		struct addrinfo hints = {
 			.ai_family = AF_INET,
 			.ai_socktype = SOCK_RAW,
@@ -963,7 +2211,7 @@ int main(int argc, char **argv)
 	} else
 		ctl.gdst_family = AF_INET;
 
-	if (!ctl.device.name)
+	if (!ctl.device.name && !ctl.monitoring)
 		guess_device(&ctl);
 
 	if (check_device(&ctl) < 0)
@@ -972,6 +2220,8 @@ int main(int argc, char **argv)
 	if (!ctl.device.ifindex) {
 		if (ctl.device.name)
 			error(2, 0, _("Device %s not available."), ctl.device.name);
+		if (ctl.monitoring)
+			error(2, 0, _("Suitable device could not be determined. Please, use option -I."));
 		error(0, 0, _("Suitable device could not be determined. Please, use option -I."));
 	}
 
@@ -981,7 +2231,7 @@ int main(int argc, char **argv)
 	if (!ctl.dad && ctl.unsolicited && ctl.source == NULL)
 		ctl.gsrc = ctl.gdst;
 
-	if (!ctl.dad || ctl.source) {
+	if ((!ctl.dad || ctl.source) && !ctl.monitoring) {
 		struct sockaddr_in saddr;
 		int probe_fd = socket(AF_INET, SOCK_DGRAM, 0);
 
@@ -1038,20 +2288,38 @@ int main(int argc, char **argv)
 			printf(_("Interface \"%s\" is not ARPable (no ll address)\n"), ctl.device.name);
 		exit(ctl.dad ? 0 : 2);
 	}
+	/* Such as the 20 bytes of InfiniBand, longer than sweeps and stations keep. */
+	if ((ctl.sweeping || ctl.monitoring) &&
+	    ((struct sockaddr_ll *)&ctl.me)->sll_halen > MAX_HALEN)
+		error(2, 0, _("-S, -N and -m cannot be used on %s, its hardware addresses are too long"),
+		      ctl.device.name);
+
+	attach_filter(&ctl);
 
 	ctl.he = ctl.me;
 
 	find_broadcast_address(&ctl);
 
-	if (!ctl.quiet) {
-		printf(_("ARPING %s "), inet_ntoa(ctl.gdst));
+	if (ctl.monitoring) {
+		monitor_setup(&ctl);
+		if (!ctl.quiet)
+			printf(_("Monitoring ARP on %s\n"), ctl.device.name);
+	} else if (!ctl.quiet) {
+		if (ctl.sweeping)
+			printf(_("ARPING %zu addresses "), ctl.sweep.nhosts);
+		else
+			printf(_("ARPING %s "), inet_ntoa(ctl.gdst));
 		printf(_("from %s %s\n"), inet_ntoa(ctl.gsrc), ctl.device.name ? ctl.device.name : "");
 	}
 
-	if (!ctl.source && !ctl.gsrc.s_addr && !ctl.dad)
+	if (!ctl.source && !ctl.gsrc.s_addr && !ctl.dad && !ctl.monitoring)
 		error(2, errno, _("no source address in not-DAD mode"));
 
-	drop_capabilities();
+	drop_capabilities(&ctl);
 
+	if (ctl.monitoring)
+		return monitor_loop(&ctl);
+	if (ctl.sweeping)
+		return sweep_loop(&ctl);
 	return event_loop(&ctl);
 }
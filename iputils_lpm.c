@@ -0,0 +1,412 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "iputils_common.h"
+#include "iputils_lpm.h"
+
+static int key_bit(uint32_t const *key, int bit)
+{
+	return (key[bit >> 5] >> (31 - (bit & 31))) & 1;
+}
+
+/* Number of leading bits a and b have in common, at most max. */
+static int key_common(uint32_t const *a, uint32_t const *b, int max)
+{
+	int i;
+
+	for (i = 0; i * 32 < max; i++) {
+		uint32_t x = a[i] ^ b[i];
+
+		if (x) {
+			int n = i * 32 + __builtin_clz(x);
+
+			return n < max ? n : max;
+		}
+	}
+	return max;
+}
+
+static void key_mask(uint32_t *key, int len)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (len <= i * 32)
+			key[i] = 0;
+		else if (len < (i + 1) * 32)
+			key[i] &= ~(0xffffffffu >> (len - i * 32));
+	}
+}
+
+static uint32_t lpm_node_new(struct lpm_trie *tr, uint32_t const *key, int len)
+{
+	struct lpm_node *n;
+
+	if (tr->nnodes == tr->alloc) {
+		uint32_t alloc = tr->alloc ? tr->alloc * 2 : 1024;
+
+		n = realloc(tr->node, alloc * sizeof(*n));
+		if (!n)
+			error(2, errno, _("memory allocation failed"));
+		tr->node = n;
+		tr->alloc = alloc;
+	}
+	n = &tr->node[tr->nnodes];
+	memset(n, 0, sizeof(*n));
+	memcpy(n->key, key, sizeof(n->key));
+	key_mask(n->key, len);
+	n->len = len;
+	return tr->nnodes++;
+}
+
+/* The node of a prefix, made on the way if it is new. */
+static struct lpm_node *lpm_insert(struct lpm_trie *tr, uint32_t const *key, int len)
+{
+	uint32_t cur = 0;
+
+	if (!tr->nnodes)
+		lpm_node_new(tr, key, 0);
+	while (tr->node[cur].len != len) {
+		int bit = key_bit(key, tr->node[cur].len);
+		uint32_t c = tr->node[cur].child[bit];
+		uint32_t n;
+		int clen;
+		int common;
+
+		if (!c) {
+			n = lpm_node_new(tr, key, len);
+			tr->node[cur].child[bit] = n;
+			return &tr->node[n];
+		}
+		clen = tr->node[c].len;
+		common = key_common(key, tr->node[c].key, len < clen ? len : clen);
+		if (common == clen) {
+			cur = c;
+			continue;
+		}
+		/* Split the edge to c where the prefixes part. */
+		n = lpm_node_new(tr, key, common);
+		tr->node[n].child[key_bit(tr->node[c].key, common)] = c;
+		tr->node[cur].child[bit] = n;
+		if (common == len)
+			return &tr->node[n];
+		cur = n;
+	}
+	return &tr->node[cur];
+}
+
+/*
+ * Renumber the nodes depth first, insertion order scatters a subtrie all
+ * over the array and a lookup would miss the cache at every node.
+ */
+static void lpm_relayout(struct lpm_trie *tr)
+{
+	struct lpm_node *node;
+	uint32_t *map;
+	uint32_t *stack;
+	uint32_t sp = 0;
+	uint32_t k = 0;
+	uint32_t i;
+
+	if (!tr->nnodes)
+		return;
+	node = malloc(tr->nnodes * sizeof(*node));
+	map = malloc(tr->nnodes * sizeof(*map));
+	stack = malloc(tr->nnodes * sizeof(*stack));
+	if (!node || !map || !stack)
+		error(2, errno, _("memory allocation failed"));
+	stack[sp++] = 0;
+	while (sp) {
+		uint32_t o = stack[--sp];
+
+		map[o] = k++;
+		if (tr->node[o].child[1])
+			stack[sp++] = tr->node[o].child[1];
+		if (tr->node[o].child[0])
+			stack[sp++] = tr->node[o].child[0];
+	}
+	for (i = 0; i < tr->nnodes; i++) {
+		struct lpm_node *n = &node[map[i]];
+
+		*n = tr->node[i];
+		/* The root is nobody's child, 0 stays none. */
+		n->child[0] = map[n->child[0]];
+		n->child[1] = map[n->child[1]];
+	}
+	free(tr->node);
+	free(map);
+	free(stack);
+	tr->node = node;
+	tr->alloc = tr->nnodes;
+}
+
+/* Fill the direct table, walking the top of the trie once for every entry. */
+static void lpm_build_direct(struct lpm_trie *tr)
+{
+	uint32_t v;
+
+	if (!tr->nnodes)
+		return;
+	tr->direct = calloc(1 << LPM_DIRECT_BITS, sizeof(*tr->direct));
+	if (!tr->direct)
+		error(2, errno, _("memory allocation failed"));
+	for (v = 0; v < 1 << LPM_DIRECT_BITS; v++) {
+		uint32_t key[4] = { v << (32 - LPM_DIRECT_BITS), 0, 0, 0 };
+		uint32_t cur = 0;
+
+		while (1) {
+			struct lpm_node const *n = &tr->node[cur];
+
+			/* The bits past the index decide from here on. */
+			if (n->len >= LPM_DIRECT_BITS) {
+				tr->direct[v].node = cur;
+				break;
+			}
+			if (key_common(key, n->key, n->len) < n->len)
+				break;
+			if (n->label_len)
+				tr->direct[v].best = cur + 1;
+			cur = n->child[key_bit(key, n->len)];
+			if (!cur)
+				break;
+		}
+	}
+}
+
+/* "a.b.c.d/len" or an address alone, for a host route. */
+static struct lpm_trie *parse_prefix(struct lpm_table *t, char const *p, size_t len,
+				     uint32_t *key, int *plen)
+{
+	char buf[INET6_ADDRSTRLEN + 8];
+	unsigned char addr[16];
+	struct lpm_trie *tr;
+	char *slash;
+	char *end;
+	int family;
+	int i;
+
+	if (!len || len >= sizeof(buf))
+		return NULL;
+	memcpy(buf, p, len);
+	buf[len] = 0;
+	slash = strchr(buf, '/');
+	if (slash)
+		*slash++ = 0;
+	family = strchr(buf, ':') ? AF_INET6 : AF_INET;
+	if (inet_pton(family, buf, addr) != 1)
+		return NULL;
+	tr = family == AF_INET6 ? &t->v6 : &t->v4;
+	*plen = tr->bits;
+	if (slash) {
+		errno = 0;
+		*plen = strtol(slash, &end, 10);
+		if (errno || end == slash || *end || *plen < 0 || *plen > tr->bits)
+			return NULL;
+	}
+	memset(key, 0, 4 * sizeof(*key));
+	for (i = 0; i < tr->bits / 32; i++) {
+		uint32_t w;
+
+		memcpy(&w, addr + 4 * i, sizeof(w));
+		key[i] = ntohl(w);
+	}
+	return tr;
+}
+
+static char const *skip_space(char const *p, char const *end)
+{
+	while (p < end && isspace((unsigned char)*p))
+		p++;
+	return p;
+}
+
+static char const *skip_word(char const *p, char const *end)
+{
+	while (p < end && !isspace((unsigned char)*p))
+		p++;
+	return p;
+}
+
+/*
+ * bgpdump -m: TABLE_DUMP2|time|B|peer|peer AS|prefix|AS path|origin|...
+ * The origin AS is the last one of the path, an AS set is taken whole.
+ */
+static int parse_bgpdump(char const *p, char const *end, char const **prefix,
+			 size_t *plen, char const **label, size_t *llen)
+{
+	char const *field[7];
+	char const *q;
+	int n = 0;
+
+	field[n++] = p;
+	for (q = p; q < end && n < 7; q++)
+		if (*q == '|')
+			field[n++] = q + 1;
+	if (n < 7)
+		return 0;
+	*prefix = field[5];
+	*plen = field[6] - 1 - field[5];
+	q = memchr(field[6], '|', end - field[6]);
+	if (!q)
+		q = end;
+	while (q > field[6] && isspace((unsigned char)q[-1]))
+		q--;
+	for (*label = q; *label > field[6] && !isspace((unsigned char)(*label)[-1]); (*label)--)
+		;
+	*llen = q - *label;
+	return *llen > 0;
+}
+
+static void lpm_parse_line(struct lpm_table *t, char const *p, char const *end)
+{
+	struct lpm_trie *tr;
+	struct lpm_node *n;
+	char const *prefix;
+	char const *label;
+	size_t plen;
+	size_t llen;
+	uint32_t key[4];
+	int len;
+	int asn = 0;
+
+	p = skip_space(p, end);
+	while (end > p && isspace((unsigned char)end[-1]))
+		end--;
+	if (p == end || *p == '#')
+		return;
+	if (end - p > 10 && (!strncmp(p, "TABLE_DUMP", 10) || !strncmp(p, "BGP4MP", 6))) {
+		if (!parse_bgpdump(p, end, &prefix, &plen, &label, &llen))
+			return;
+		asn = 1;
+	} else {
+		prefix = p;
+		p = skip_word(p, end);
+		plen = p - prefix;
+		label = skip_space(p, end);
+		llen = end - label;
+	}
+	if (!llen)
+		return;
+	if (llen > UINT16_MAX)
+		llen = UINT16_MAX;
+	tr = parse_prefix(t, prefix, plen, key, &len);
+	if (!tr)
+		return;
+	n = lpm_insert(tr, key, len);
+	/* A prefix seen from several peers keeps its first label. */
+	if (n->label_len)
+		return;
+	n->label = label - t->map;
+	n->label_len = llen;
+	n->asn = asn;
+	t->prefixes++;
+}
+
+struct lpm_table *lpm_load(char const *path)
+{
+	struct lpm_table *t;
+	struct stat st;
+	char const *p;
+	char const *end;
+	int fd;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		error(2, errno, _("memory allocation failed"));
+	t->v4.bits = 32;
+	t->v6.bits = 128;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st))
+		error(2, errno, "%s", path);
+	if (st.st_size) {
+		t->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (t->map == MAP_FAILED)
+			error(2, errno, "mmap %s", path);
+		t->size = st.st_size;
+		madvise((void *)t->map, t->size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	for (p = t->map, end = t->map + t->size; p < end;) {
+		char const *nl = memchr(p, '\n', end - p);
+
+		if (!nl)
+			nl = end;
+		lpm_parse_line(t, p, nl);
+		p = nl + 1;
+	}
+	if (!t->prefixes)
+		error(2, 0, _("no prefixes in %s"), path);
+	/* From now on the labels are read here and there. */
+	madvise((void *)t->map, t->size, MADV_RANDOM);
+	lpm_relayout(&t->v4);
+	lpm_relayout(&t->v6);
+	lpm_build_direct(&t->v4);
+	lpm_build_direct(&t->v6);
+	return t;
+}
+
+static struct lpm_node const *lpm_lookup(struct lpm_trie const *tr, uint32_t const *key)
+{
+	uint32_t best;
+	uint32_t cur;
+
+	if (!tr->direct)
+		return NULL;
+	best = tr->direct[key[0] >> (32 - LPM_DIRECT_BITS)].best;
+	cur = tr->direct[key[0] >> (32 - LPM_DIRECT_BITS)].node;
+	while (cur) {
+		struct lpm_node const *n = &tr->node[cur];
+
+		if (key_common(key, n->key, n->len) < n->len)
+			break;
+		if (n->label_len)
+			best = cur + 1;
+		if (n->len == tr->bits)
+			break;
+		cur = n->child[key_bit(key, n->len)];
+	}
+	return best ? &tr->node[best - 1] : NULL;
+}
+
+/* The label of the longest prefix that covers addr, returns 0 if none does. */
+int lpm_label(struct lpm_table const *t, int family, void const *addr, char *buf,
+	      size_t size)
+{
+	static const unsigned char mapped[12] = { [10] = 0xff, [11] = 0xff };
+	unsigned char const *a = addr;
+	struct lpm_trie const *tr = &t->v4;
+	struct lpm_node const *n;
+	uint32_t key[4] = { 0 };
+	int i;
+
+	if (family == AF_INET6 && !memcmp(a, mapped, sizeof(mapped)))
+		a += sizeof(mapped);
+	else if (family == AF_INET6)
+		tr = &t->v6;
+	else if (family != AF_INET)
+		return 0;
+	for (i = 0; i < tr->bits / 32; i++) {
+		uint32_t w;
+
+		memcpy(&w, a + 4 * i, sizeof(w));
+		key[i] = ntohl(w);
+	}
+	n = lpm_lookup(tr, key);
+	if (!n)
+		return 0;
+	snprintf(buf, size, "%s%.*s", n->asn ? "AS" : "", n->label_len, t->map + n->label);
+	return 1;
+}
@@ -0,0 +1,62 @@
+#ifndef IPUTILS_LPM_H
+#define IPUTILS_LPM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Longest prefix match of addresses against a local prefix -> label file,
+ * to annotate them with origin AS numbers or site names.  The file is
+ * either plain text, a prefix and its label per line:
+ *
+ *	192.0.2.0/24 lab network
+ *	2001:db8::/32 AS64500
+ *
+ * or the one line per route output of bgpdump -m, where the label is the
+ * origin AS of the path.  Labels are not copied, they are used in place
+ * in the memory mapped file.
+ */
+#define LPM_DIRECT_BITS		16
+
+struct lpm_node {
+	uint32_t key[4];		/* prefix, host order words, zero past len */
+	uint32_t child[2];		/* node index, 0 for none */
+	uint32_t label;			/* offset in the file */
+	uint16_t label_len;		/* 0 for a node without prefix of its own */
+	uint8_t len;			/* prefix bits */
+	uint8_t asn;			/* the label is an origin AS number */
+};
+
+/* Where a lookup goes on after the first LPM_DIRECT_BITS of the address. */
+struct lpm_direct {
+	uint32_t node;			/* 0 if no longer prefix can match */
+	uint32_t best;			/* node index + 1 of the best match so far */
+};
+
+/*
+ * Path compressed binary trie (Patricia) of one address family, in one
+ * array so that it costs no pointer per node.  A direct table indexed by
+ * the first bits of the address skips the top levels, so a lookup only
+ * touches the few nodes of the longer prefixes.
+ */
+struct lpm_trie {
+	struct lpm_node *node;		/* node 0 is the root, /0 */
+	uint32_t nnodes;
+	uint32_t alloc;
+	int bits;			/* 32 or 128 */
+	struct lpm_direct *direct;
+};
+
+struct lpm_table {
+	char const *map;
+	size_t size;
+	long prefixes;
+	struct lpm_trie v4;
+	struct lpm_trie v6;
+};
+
+struct lpm_table *lpm_load(char const *path);
+int lpm_label(struct lpm_table const *t, int family, void const *addr, char *buf,
+	      size_t size);
+
+#endif /* IPUTILS_LPM_H */
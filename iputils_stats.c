@@ -0,0 +1,115 @@
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "iputils_stats.h"
+
+#define RTT_HIST_SUB	(1 << RTT_HIST_SUB_BITS)
+#define RTT_HIST_MAXV	((1L << 32) - 1)
+
+static int rtt_bucket(long v)
+{
+	int msb;
+
+	if (v < RTT_HIST_LINEAR)
+		return v < 0 ? 0 : v;
+	if (v > RTT_HIST_MAXV)
+		v = RTT_HIST_MAXV;
+	msb = 63 - __builtin_clzll((unsigned long long)v);
+	return RTT_HIST_LINEAR + (msb - 4) * RTT_HIST_SUB +
+	       ((v >> (msb - RTT_HIST_SUB_BITS)) & (RTT_HIST_SUB - 1));
+}
+
+/* Midpoint of a bucket, the value reported for percentiles falling in it. */
+static long rtt_bucket_value(int idx)
+{
+	int msb, sub;
+	long width;
+
+	if (idx < RTT_HIST_LINEAR)
+		return idx;
+	msb = (idx - RTT_HIST_LINEAR) / RTT_HIST_SUB + 4;
+	sub = (idx - RTT_HIST_LINEAR) % RTT_HIST_SUB;
+	width = 1L << (msb - RTT_HIST_SUB_BITS);
+	return (RTT_HIST_SUB + sub) * width + width / 2;
+}
+
+static long llsqrt(long long a)
+{
+	long long prev = LLONG_MAX;
+	long long x = a;
+
+	if (x > 0) {
+		while (x < prev) {
+			prev = x;
+			x = (x + (a / x)) / 2;
+		}
+	}
+
+	return (long)x;
+}
+
+void rtt_stats_init(struct rtt_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	s->min = LONG_MAX;
+}
+
+void rtt_stats_add(struct rtt_stats *s, long usec)
+{
+	s->count++;
+	s->sum += usec;
+	s->sum2 += (double)usec * usec;
+	if (usec < s->min)
+		s->min = usec;
+	if (usec > s->max)
+		s->max = usec;
+	s->hist[rtt_bucket(usec)]++;
+}
+
+long rtt_stats_avg(const struct rtt_stats *s)
+{
+	return s->count ? (long)(s->sum / s->count) : 0;
+}
+
+long rtt_stats_mdev(const struct rtt_stats *s)
+{
+	double avg, var;
+
+	if (!s->count)
+		return 0;
+	avg = s->sum / s->count;
+	var = s->sum2 / s->count - avg * avg;
+	return var > 0 ? llsqrt((long long)var) : 0;
+}
+
+/* Nearest-rank percentile, pct in 0..100, clamped to the observed range. */
+long rtt_stats_percentile(const struct rtt_stats *s, int pct)
+{
+	long rank, seen = 0;
+	long v;
+	int i;
+
+	if (!s->count)
+		return 0;
+	rank = (s->count * pct + 99) / 100;
+	if (rank < 1)
+		rank = 1;
+	for (i = 0; i < RTT_HIST_BUCKETS; i++) {
+		seen += s->hist[i];
+		if (seen >= rank)
+			break;
+	}
+	v = rtt_bucket_value(i < RTT_HIST_BUCKETS ? i : RTT_HIST_BUCKETS - 1);
+	if (v < s->min)
+		v = s->min;
+	if (v > s->max)
+		v = s->max;
+	return v;
+}
+
+/* A column of the rtt tables, usec printed as msecs. */
+void rtt_print_ms(long usec)
+{
+	printf(" %5ld.%03ld", usec / 1000, usec % 1000);
+}
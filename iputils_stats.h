@@ -0,0 +1,32 @@
+#ifndef IPUTILS_STATS_H
+#define IPUTILS_STATS_H
+
+#include <stdint.h>
+
+/*
+ * Round trip time accumulator shared by the tools.  Besides the classic
+ * min/avg/max/mdev it keeps a log-linear histogram (four buckets per power
+ * of two, exact below 16us), which is enough for percentiles within ~12%
+ * at a fixed 512 bytes per instance.
+ */
+#define RTT_HIST_LINEAR		16
+#define RTT_HIST_SUB_BITS	2
+#define RTT_HIST_BUCKETS	128
+
+struct rtt_stats {
+	long count;
+	long min;			/* usec */
+	long max;
+	double sum;
+	double sum2;
+	uint32_t hist[RTT_HIST_BUCKETS];
+};
+
+void rtt_stats_init(struct rtt_stats *s);
+void rtt_stats_add(struct rtt_stats *s, long usec);
+long rtt_stats_avg(const struct rtt_stats *s);
+long rtt_stats_mdev(const struct rtt_stats *s);
+long rtt_stats_percentile(const struct rtt_stats *s, int pct);
+void rtt_print_ms(long usec);
+
+#endif /* IPUTILS_STATS_H */
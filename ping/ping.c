@@ -74,6 +74,7 @@ struct icmp_filter {
 
 ping_func_set_st ping4_func_set = {
 	.send_probe = ping4_send_probe,
+	.send_train = ping4_send_train,
 	.receive_error_msg = ping4_receive_error_msg,
 	.parse_reply = ping4_parse_reply,
 	.install_filter = ping4_install_filter
@@ -212,7 +213,7 @@ static void set_socket_option(socket_st *sock, int level, int optname,
 }
 
 /* Much like strtod(3), but will fails if str is not valid number. */
-static double ping_strtod(const char *str, const char *err_msg)
+double ping_strtod(const char *str, const char *err_msg)
 {
 	double num;
 	char *end = NULL;
@@ -278,7 +279,7 @@ static int parseflow(char *str)
 }
 
 /* Set Type of Service (TOS) and other Quality of Service relating bits */
-static int parsetos(char *str)
+int parsetos(char *str)
 {
 	const char *cp;
 	int tos;
@@ -318,6 +319,7 @@ main(int argc, char **argv)
 	socket_st sock6 = { .fd = -1 };
 	char *target;
 	char *outpack_fill = NULL;
+	int datalen_set = 0;
 	static struct ping_rts rts = {
 		.interval = 1000,
 		.preload = 1,
@@ -364,7 +366,7 @@ main(int argc, char **argv)
 		hints.ai_family = AF_INET6;
 
 	/* Parse command line options */
-	while ((ch = getopt(argc, argv, "h?" "4bRT:" "6F:N:" "aABc:CdDe:fHi:I:l:Lm:M:nOp:qQ:rs:S:t:UvVw:W:x:")) != EOF) {
+	while ((ch = getopt(argc, argv, "h?" "4bRT:" "6F:N:" "aABc:CdDe:E:fG:Hi:I:k:K:l:Lm:M:nOp:P:qQ:rs:S:t:UvVw:W:x:z:")) != EOF) {
 		switch(ch) {
 		/* IPv4 specific options */
 		case '4':
@@ -522,6 +524,14 @@ main(int argc, char **argv)
 			rts.opt_quiet = 1;
 			break;
 		case 'Q':
+			if (strchr(optarg, ',')) {
+				free(rts.qos);
+				rts.qos = parse_qos_classes(optarg);
+				rts.settos = rts.tclass = 0;
+				break;
+			}
+			free(rts.qos);
+			rts.qos = NULL;
 			rts.settos = parsetos(optarg); /* IPv4 */
 			rts.tclass = rts.settos; /* IPv6 */
 			break;
@@ -530,6 +540,7 @@ main(int argc, char **argv)
 			break;
 		case 's':
 			rts.datalen = strtol_or_err(optarg, _("invalid argument"), 0, INT_MAX);
+			datalen_set = 1;
 			break;
 		case 'S':
 			rts.sndbuf = strtol_or_err(optarg, _("invalid argument"), 1, INT_MAX);
@@ -565,6 +576,33 @@ main(int argc, char **argv)
         case 'x': /*GGS*/
 		    rts.opt_exit_cond = parse_exit_cond(optarg);
 		    break;
+		case 'E':
+			free(rts.ratesearch);
+			rts.ratesearch = parse_rate_search(optarg);
+			break;
+		case 'k':
+			free(rts.train);
+			rts.train = parse_train(optarg);
+			break;
+		case 'G':
+			rts.prefix_file = optarg;
+			break;
+		case 'P':
+			free(rts.peers);
+			rts.peers = parse_peer_sort(optarg);
+			break;
+		case 'K':
+			if (rts.flows)
+				free(rts.flows->keys);
+			free(rts.flows);
+			rts.flows = parse_flow_keys(optarg);
+			break;
+		case 'z':
+			if (rts.sweep)
+				free(rts.sweep->sizes);
+			free(rts.sweep);
+			rts.sweep = parse_size_sweep(optarg);
+			break;
 		default:
 			usage();
 			break;
@@ -589,6 +627,26 @@ main(int argc, char **argv)
 
 	target = argv[argc - 1];
 
+	if (rts.ratesearch && (rts.opt_adaptive || rts.opt_flood || rts.train))
+		error(2, 0, _("-E cannot be used together with -A, -f or -k"));
+	if (rts.qos && rts.train)
+		error(2, 0, _("-k cannot be used with a list of TOS classes"));
+	if (rts.flows && rts.train)
+		error(2, 0, _("-k and -K cannot be used together"));
+
+	if (rts.sweep) {
+		if (datalen_set)
+			error(2, 0, _("-s and -z cannot be used together"));
+		/* Buffers are sized for the largest probe. */
+		rts.datalen = rts.sweep->maxlen;
+		if (rts.train)
+			error(2, 0, _("-k and -z cannot be used together"));
+	}
+
+	/* Every step of the search is timed from the probe payload. */
+	if (rts.ratesearch && rts.datalen < (int)sizeof(struct timeval))
+		error(2, 0, _("-E needs -s of at least %zu bytes"), sizeof(struct timeval));
+
 	rts.outpack = malloc(rts.datalen + 28);
 	if (!rts.outpack)
 		error(2, errno, _("memory allocation failed"));
@@ -1039,6 +1097,9 @@ int ping4_run(struct ping_rts *rts, int argc, char **argv, struct addrinfo *ai,
 	if (!(packet = (unsigned char *)malloc((unsigned int)packlen)))
 		error(2, errno, _("memory allocation failed"));
 
+	/* Once broadcast or multicast is known, and before the banner. */
+	peers_prepare(rts);
+
     if(rts->opt_quiet < 2) /*GGS*/
 	{
 		printf(_("PING %s (%s) "), rts->hostname, inet_ntoa(rts->whereto.sin_addr));
@@ -1048,6 +1109,7 @@ int ping4_run(struct ping_rts *rts, int argc, char **argv, struct addrinfo *ai,
 	}
 
 	setup(rts, sock);
+	flow_setup(rts, sock, AF_INET);
 	if (rts->opt_connect_sk &&
 	    connect(sock->fd, (struct sockaddr *)&dst, sizeof(dst)) == -1)
 		error(2, errno, "connect failed");
@@ -1456,6 +1518,9 @@ int ping4_receive_error_msg(struct ping_rts *rts, socket_st *sock)
 
 	if (e->ee_origin == SO_EE_ORIGIN_LOCAL) {
 		local_errors++;
+		if (res >= (ssize_t) sizeof(icmph) && icmph.type == ICMP_ECHO &&
+		    is_ours(rts, sock, icmph.un.echo.id))
+			loss_set(rts, ntohs(icmph.un.echo.sequence), FATE_SEND_ERROR);
 		if (rts->opt_quiet)
 			goto out;
 		if (rts->opt_flood)
@@ -1478,6 +1543,8 @@ int ping4_receive_error_msg(struct ping_rts *rts, socket_st *sock)
 		}
 
 		acknowledge(rts, ntohs(icmph.un.echo.sequence));
+		loss_icmp(rts, ntohs(icmph.un.echo.sequence), AF_INET,
+			  e->ee_type, e->ee_code);
 
 		if (sock->socktype == SOCK_RAW) {
 			struct icmp_filter filt;
@@ -1556,12 +1623,11 @@ in_cksum(const unsigned short *addr, int len, unsigned short csum)
  * of the data portion are used to hold a UNIX "timeval" struct in VAX
  * byte-order, to compute the round-trip time.
  */
-int ping4_send_probe(struct ping_rts *rts, socket_st *sock, void *packet,
-		     unsigned packet_size __attribute__((__unused__)))
+static int ping4_build_probe(struct ping_rts *rts, void *packet,
+			     unsigned packet_size __attribute__((__unused__)))
 {
 	struct icmphdr *icp;
 	int cc;
-	int i;
 
 	icp = (struct icmphdr *)packet;
 	icp->type = ICMP_ECHO;
@@ -1582,10 +1648,22 @@ int ping4_send_probe(struct ping_rts *rts, socket_st *sock, void *packet,
 		}
 	}
 
-	cc = rts->datalen + 8;			/* skips ICMP portion */
+	cc = probe_datalen(rts) + 8;		/* skips ICMP portion */
 
 	/* compute ICMP checksum here */
-	icp->checksum = in_cksum((unsigned short *)icp, cc, 0);
+	if (rts->sweep) {
+		struct size_probe *sp = size_sweep_current(rts->sweep);
+		int hdrlen = 8 + sizeof(struct timeval);
+
+		/* The payload behind the timestamp never changes. */
+		if (!sp->csum_valid) {
+			sp->csum = ~in_cksum((unsigned short *)((char *)icp + hdrlen), cc - hdrlen, 0);
+			sp->csum_valid = 1;
+		}
+		icp->checksum = in_cksum((unsigned short *)icp, hdrlen, sp->csum);
+	} else {
+		icp->checksum = in_cksum((unsigned short *)icp, cc, 0);
+	}
 
 	if (rts->timing && !rts->opt_latency) {
 		struct timeval tmp_tv;
@@ -1594,11 +1672,42 @@ int ping4_send_probe(struct ping_rts *rts, socket_st *sock, void *packet,
 		icp->checksum = in_cksum((unsigned short *)&tmp_tv, sizeof(tmp_tv), ~icp->checksum);
 	}
 
-	i = sendto(sock->fd, icp, cc, 0, (struct sockaddr *)&rts->whereto, sizeof(rts->whereto));
+	return cc;
+}
+
+int ping4_send_probe(struct ping_rts *rts, socket_st *sock, void *packet,
+		     unsigned packet_size)
+{
+	int cc;
+	int i;
+
+	cc = ping4_build_probe(rts, packet, packet_size);
+	if (rts->qos) {
+		char control[CMSG_SPACE(sizeof(int))] __attribute__((aligned(sizeof(size_t))));
+		struct iovec iov = { .iov_base = packet, .iov_len = cc };
+		struct msghdr mhdr = {
+			.msg_name = &rts->whereto,
+			.msg_namelen = sizeof(rts->whereto),
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = control,
+			.msg_controllen = qos_cmsg(rts, AF_INET, control, sizeof(control)),
+		};
+
+		i = sendmsg(sock->fd, &mhdr, 0);
+	} else {
+		i = sendto(sock->fd, packet, cc, 0, (struct sockaddr *)&rts->whereto, sizeof(rts->whereto));
+	}
 
 	return (cc == i ? 0 : i);
 }
 
+int ping4_send_train(struct ping_rts *rts, socket_st *sock)
+{
+	return train_sendmmsg(rts, sock, ping4_build_probe, &rts->whereto,
+			      sizeof(rts->whereto), NULL, 0);
+}
+
 /*
  * parse_reply --
  *	Print out the packet, if it came from us.  This logic is necessary
@@ -1678,6 +1787,7 @@ int ping4_parse_reply(struct ping_rts *rts, struct socket_st *sock,
 		if (gather_statistics(rts, (uint8_t *)icp, sizeof(*icp), cc,
 				      ntohs(icp->un.echo.sequence),
 				      reply_ttl, 0, tv, pr_addr(rts, from, sizeof *from),
+				      (struct sockaddr *)from,
 				      pr_echo_reply, rts->multicast, wrong_source)) {
 			fflush(stdout);
 			return 0;
@@ -1710,6 +1820,8 @@ int ping4_parse_reply(struct ping_rts *rts, struct socket_st *sock,
 					     icp->type != ICMP_SOURCE_QUENCH);
 				if (error_pkt) {
 					acknowledge(rts, ntohs(icp1->un.echo.sequence));
+					loss_icmp(rts, ntohs(icp1->un.echo.sequence), AF_INET,
+						  icp->type, icp->code);
 					return 0;
 				}
 				if (rts->opt_quiet || rts->opt_flood)
@@ -1841,6 +1953,10 @@ void ping4_install_filter(struct ping_rts *rts, socket_st *sock)
 		return;
 	once = 1;
 
+	/* Replies come back on several identifiers, is_ours() sorts them. */
+	if (rts->flows && rts->flows->mode == FLOW_IDENT)
+		return;
+
 	/* Patch bpflet for current identifier. */
 	insns[2] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htons(rts->ident), 0, 1);
 
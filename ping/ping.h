@@ -34,6 +34,14 @@
 #include <resolv.h>
 
 #include "ping_exit.h" /*GGS*/
+#include "ping_loss.h"
+#include "ping_ttl.h"
+#include "ping_sweep.h"
+#include "ping_train.h"
+#include "ping_rate.h"
+#include "ping_qos.h"
+#include "ping_flow.h"
+#include "ping_peers.h"
 
 #ifdef HAVE_LIBCAP
 # include <sys/prctl.h>
@@ -41,6 +49,7 @@
 #endif
 
 #include "iputils_common.h"
+#include "iputils_lpm.h"
 #include "iputils_ni.h"
 
 #ifdef USE_IDN
@@ -122,12 +131,14 @@ struct ping_rts;
 
 int ping4_run(struct ping_rts *rts, int argc, char **argv, struct addrinfo *ai, socket_st *sock);
 int ping4_send_probe(struct ping_rts *rts, socket_st *, void *packet, unsigned packet_size);
+int ping4_send_train(struct ping_rts *rts, socket_st *);
 int ping4_receive_error_msg(struct ping_rts *, socket_st *);
 int ping4_parse_reply(struct ping_rts *, socket_st *, struct msghdr *msg, int cc, void *addr, struct timeval *);
 void ping4_install_filter(struct ping_rts *rts, socket_st *);
 
 typedef struct ping_func_set_st {
 	int (*send_probe)(struct ping_rts *rts, socket_st *, void *packet, unsigned packet_size);
+	int (*send_train)(struct ping_rts *rts, socket_st *);
 	int (*receive_error_msg)(struct ping_rts *rts, socket_st *sock);
 	int (*parse_reply)(struct ping_rts *rts, socket_st *, struct msghdr *msg, int len, void *addr, struct timeval *);
 	void (*install_filter)(struct ping_rts *rts, socket_st *);
@@ -172,6 +183,16 @@ struct ping_rts {
 	long ntransmitted;		/* sequence # for outbound packets = #sent */
 	long nchecksum;			/* replies with bad checksum */
 	long nerrors;			/* icmp errors */
+	struct loss_stats loss;		/* fate of every probe */
+	struct ttl_track reply_ttl;	/* reply ttl segments */
+	struct size_sweep *sweep;	/* per-probe sizes (-z) */
+	struct train_state *train;	/* packet trains (-k) */
+	struct rate_search *ratesearch;	/* maximum rate discovery (-E) */
+	struct qos_classes *qos;	/* interleaved TOS classes (-Q a,b,..) */
+	struct flow_keys *flows;	/* rotating ECMP flow keys (-K) */
+	struct peer_table *peers;	/* per-responder statistics (-P) */
+	char const *prefix_file;	/* -G, loaded once the table is known to be on */
+	struct lpm_table *prefixes;	/* responder labels by prefix (-G) */
 	int interval;			/* interval between packets (msec) */
 	int preload;
 	int deadline;			/* time to die */
@@ -406,10 +427,13 @@ extern int main_loop(struct ping_rts *rts, ping_func_set_st *fset, socket_st*,
 		     uint8_t *packet, int packlen);
 extern int finish(struct ping_rts *rts);
 extern void status(struct ping_rts *rts);
+extern double ping_strtod(const char *str, const char *err_msg);
+extern int parsetos(char *str);
 extern void common_options(int ch);
 extern int gather_statistics(struct ping_rts *rts, uint8_t *icmph, int icmplen,
 			     int cc, uint16_t seq, int hops,
 			     int csfailed, struct timeval *tv, char *from,
+			     const struct sockaddr *src,
 			     void (*pr_reply)(uint8_t *ptr, int cc), int multicast,
 			     int wrong_source);
 extern void print_timestamp(struct ping_rts *rts);
@@ -422,6 +446,7 @@ int ping6_run(struct ping_rts *rts, int argc, char **argv, struct addrinfo *ai,
 void ping6_usage(unsigned from_ping);
 
 int ping6_send_probe(struct ping_rts *rts, socket_st *sockets, void *packet, unsigned packet_size);
+int ping6_send_train(struct ping_rts *rts, socket_st *sock);
 int ping6_receive_error_msg(struct ping_rts *rts, socket_st *sockets);
 int ping6_parse_reply(struct ping_rts *rts, socket_st *, struct msghdr *msg, int cc, void *addr, struct timeval *);
 void ping6_install_filter(struct ping_rts *rts, socket_st *sockets);
@@ -76,6 +76,7 @@
 
 ping_func_set_st ping6_func_set = {
 	.send_probe = ping6_send_probe,
+	.send_train = ping6_send_train,
 	.receive_error_msg = ping6_receive_error_msg,
 	.parse_reply = ping6_parse_reply,
 	.install_filter = ping6_install_filter
@@ -113,6 +114,8 @@ int ping6_run(struct ping_rts *rts, int argc, char **argv, struct addrinfo *ai,
 	static uint32_t scope_id = 0;
 
 	if (niquery_is_enabled(&rts->ni)) {
+		if (rts->sweep || rts->train)
+			error(2, 0, _("-z and -k cannot be used with node information queries"));
 		niquery_init_nonce(&rts->ni);
 
 		if (!niquery_is_subject_valid(&rts->ni)) {
@@ -394,6 +397,9 @@ int ping6_run(struct ping_rts *rts, int argc, char **argv, struct addrinfo *ai,
 			error(2, errno, _("can't send flowinfo"));
 	}
 
+	/* Once multicast is known, and before the banner. */
+	peers_prepare(rts);
+
     if(rts->opt_quiet < 2)
 	{
 		printf(_("PING %s (%s) "), rts->hostname, pr_raw_addr(rts, &rts->whereto6, sizeof rts->whereto6));
@@ -409,6 +415,7 @@ int ping6_run(struct ping_rts *rts, int argc, char **argv, struct addrinfo *ai,
 		printf(_("%zu data bytes\n"), rts->datalen);
 	}
 	setup(rts, sock);
+	flow_setup(rts, sock, AF_INET6);
 
 	drop_capabilities();
 
@@ -540,6 +547,9 @@ int ping6_receive_error_msg(struct ping_rts *rts, socket_st *sock)
 
 	if (e->ee_origin == SO_EE_ORIGIN_LOCAL) {
 		local_errors++;
+		if ((size_t)res >= sizeof(icmph) && icmph.icmp6_type == ICMP6_ECHO_REQUEST &&
+		    is_ours(rts, sock, icmph.icmp6_id))
+			loss_set(rts, ntohs(icmph.icmp6_seq), FATE_SEND_ERROR);
 		if (rts->opt_quiet)
 			goto out;
 		if (rts->opt_flood)
@@ -563,6 +573,7 @@ int ping6_receive_error_msg(struct ping_rts *rts, socket_st *sock)
 
 		net_errors++;
 		rts->nerrors++;
+		loss_icmp(rts, ntohs(icmph.icmp6_seq), AF_INET6, e->ee_type, e->ee_code);
 		if (rts->opt_quiet)
 			goto out;
 		if (rts->opt_flood) {
@@ -605,7 +616,7 @@ int build_echo(struct ping_rts *rts, uint8_t *_icmph,
 	if (rts->timing)
 		gettimeofday((struct timeval *)&_icmph[8], NULL);
 
-	cc = rts->datalen + 8;			/* skips ICMP portion */
+	cc = probe_datalen(rts) + 8;			/* skips ICMP portion */
 
 	return cc;
 }
@@ -634,25 +645,37 @@ int build_niquery(struct ping_rts *rts, uint8_t *_nih,
 	return cc;
 }
 
-int ping6_send_probe(struct ping_rts *rts, socket_st *sock, void *packet, unsigned packet_size)
+static int ping6_build_probe(struct ping_rts *rts, void *packet, unsigned packet_size)
 {
-	int len, cc;
-
 	rcvd_clear(rts, rts->ntransmitted + 1);
 
 	if (niquery_is_enabled(&rts->ni))
-		len = build_niquery(rts, packet, packet_size);
-	else
-		len = build_echo(rts, packet, packet_size);
+		return build_niquery(rts, packet, packet_size);
+	return build_echo(rts, packet, packet_size);
+}
 
-	if (rts->cmsglen == 0) {
+int ping6_send_probe(struct ping_rts *rts, socket_st *sock, void *packet, unsigned packet_size)
+{
+	int len, cc;
+
+	len = ping6_build_probe(rts, packet, packet_size);
+
+	if (rts->cmsglen == 0 && !rts->qos) {
 		cc = sendto(sock->fd, (char *)packet, len, rts->confirm,
 			    (struct sockaddr *)&rts->whereto6,
 			    sizeof(struct sockaddr_in6));
 	} else {
+		unsigned char control[sizeof(rts->cmsgbuf) + CMSG_SPACE(sizeof(int))]
+			__attribute__((aligned(sizeof(size_t))));
+		size_t controllen = rts->cmsglen;
 		struct msghdr mhdr;
 		struct iovec iov;
 
+		memcpy(control, rts->cmsgbuf, rts->cmsglen);
+		if (rts->qos)
+			controllen += qos_cmsg(rts, AF_INET6, control + controllen,
+					       sizeof(control) - controllen);
+
 		iov.iov_len = len;
 		iov.iov_base = packet;
 
@@ -661,8 +684,8 @@ int ping6_send_probe(struct ping_rts *rts, socket_st *sock, void *packet, unsign
 		mhdr.msg_namelen = sizeof(struct sockaddr_in6);
 		mhdr.msg_iov = &iov;
 		mhdr.msg_iovlen = 1;
-		mhdr.msg_control = rts->cmsgbuf;
-		mhdr.msg_controllen = rts->cmsglen;
+		mhdr.msg_control = control;
+		mhdr.msg_controllen = controllen;
 
 		cc = sendmsg(sock->fd, &mhdr, rts->confirm);
 	}
@@ -671,6 +694,12 @@ int ping6_send_probe(struct ping_rts *rts, socket_st *sock, void *packet, unsign
 	return (cc == len ? 0 : cc);
 }
 
+int ping6_send_train(struct ping_rts *rts, socket_st *sock)
+{
+	return train_sendmmsg(rts, sock, ping6_build_probe, &rts->whereto6,
+			      sizeof(rts->whereto6), rts->cmsgbuf, rts->cmsglen);
+}
+
 void pr_echo_reply(uint8_t *_icmph, int cc __attribute__((__unused__)))
 {
 	struct icmp6_hdr *icmph = (struct icmp6_hdr *)_icmph;
@@ -869,6 +898,7 @@ int ping6_parse_reply(struct ping_rts *rts, socket_st *sock,
 		if (gather_statistics(rts, (uint8_t *)icmph, sizeof(*icmph), cc,
 				      ntohs(icmph->icmp6_seq),
 				      hops, 0, tv, pr_addr(rts, from, sizeof *from),
+				      (struct sockaddr *)from,
 				      pr_echo_reply,
 				      rts->multicast, wrong_source)) {
 			fflush(stdout);
@@ -882,6 +912,7 @@ int ping6_parse_reply(struct ping_rts *rts, socket_st *sock,
 		if (gather_statistics(rts, (uint8_t *)icmph, sizeof(*icmph), cc,
 				      seq,
 				      hops, 0, tv, pr_addr(rts, from, sizeof *from),
+				      (struct sockaddr *)from,
 				      pr_niquery_reply,
 				      rts->multicast, 0))
 			return 0;
@@ -914,6 +945,8 @@ int ping6_parse_reply(struct ping_rts *rts, socket_st *sock,
 			    !is_ours(rts, sock, icmph1->icmp6_id))
 				return 1;
 			acknowledge(rts, ntohs(icmph1->icmp6_seq));
+			loss_icmp(rts, ntohs(icmph1->icmp6_seq), AF_INET6,
+				  icmph->icmp6_type, icmph->icmp6_code);
 			return 0;
 		}
 
@@ -958,6 +991,10 @@ void ping6_install_filter(struct ping_rts *rts, socket_st *sock)
 		return;
 	once = 1;
 
+	/* Replies come back on several identifiers, is_ours() sorts them. */
+	if (rts->flows && rts->flows->mode == FLOW_IDENT)
+		return;
+
 	/* Patch bpflet for current identifier. */
 	insns[1] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htons(rts->ident), 0, 1);
 
@@ -57,24 +57,35 @@ void usage(void)
 		"  -C                 call connect() syscall on socket creation\n"
 		"  -D                 print timestamps\n"
 		"  -d                 use SO_DEBUG socket option\n"
+		"  -E <loss>[,<rtt>]  find the highest rate with at most <loss> percent loss\n"
+		"                     and median rtt at most <rtt> times the baseline\n"
 		"  -e <identifier>    define identifier for ping session, default is random for\n"
 		"                     SOCK_RAW and kernel defined for SOCK_DGRAM\n"
 		"                     Imply using SOCK_RAW (for IPv4 only for identifier 0)\n"
 		"  -f                 flood ping\n"
+		"  -G <file>          label responders by the longest matching prefix\n"
+		"                     in <file>\n"
 		"  -h                 print help and exit\n"
 		"  -H                 force reverse DNS name resolution (useful for numeric\n"
 		"                     destinations or for -f), override -n\n"
 		"  -I <interface>     either interface name or address\n"
 		"  -i <interval>      seconds between sending each packet\n"
+		"  -k <count>         send trains of <count> back-to-back probes and\n"
+		"                     estimate the path capacity from reply dispersion\n"
+		"  -K <count>         rotate probes over <count> flow labels (IPv6) or\n"
+		"                     identifiers (IPv4) to enumerate ECMP paths\n"
 		"  -L                 suppress loopback of multicast packets\n"
 		"  -l <preload>       send <preload> number of packages while waiting replies\n"
 		"  -m <mark>          tag the packets going out\n"
 		"  -M <pmtud opt>     define path MTU discovery, can be one of <do|dont|want|probe>\n"
 		"  -n                 no reverse DNS name resolution, override -H\n"
 		"  -O                 report outstanding replies\n"
+		"  -P <order>         per-responder statistics sorted by latency or loss,\n"
+		"                     default for broadcast and multicast\n"
 		"  -p <pattern>       contents of padding byte\n"
 		"  -q                 quiet output\n"
-		"  -Q <tclass>        use quality of service <tclass> bits\n"
+		"  -Q <tclass>        use quality of service <tclass> bits, a comma separated\n"
+		"                     list interleaves probes across the classes\n"
 		"  -s <size>          use <size> as number of data bytes to be sent\n"
 		"  -S <size>          use <size> as SO_SNDBUF socket option value\n"
 		"  -t <ttl>           define time to live\n"
@@ -83,6 +94,8 @@ void usage(void)
 		"  -V                 print version and exit\n"
 		"  -w <deadline>      reply wait <deadline> in seconds\n"
 		"  -W <timeout>       time to wait for response\n"
+		"  -z <sizes>         vary the data size per probe: <size,...|lin:min-max/step|\n"
+		"                     log:min-max/count|imix[:size/weight,...]>\n"
 		"\nIPv4 options:\n"
 		"  -4                 use IPv4\n"
 		"  -b                 allow pinging broadcast\n"
@@ -316,13 +329,19 @@ int pinger(struct ping_rts *rts, ping_func_set_st *fset, socket_st *sock)
 	static int oom_count;
 	static int tokens;
 	int i;
+	enum probe_fate fate = FATE_SEND_ERROR;
 
 	/* Have we already sent enough? If we have, return an arbitrary positive value. */
 	if (rts->exiting || (rts->npackets && rts->ntransmitted >= rts->npackets && !rts->deadline))
 		return 1000;
 
 	/* Check that packets < rate*time + preload */
-	if (rts->cur_time.tv_sec == 0 && rts->cur_time.tv_nsec == 0) {
+	if (rts->ratesearch) {
+		int wait = rate_wait(rts);
+
+		if (wait > 0)
+			return wait;
+	} else if (rts->cur_time.tv_sec == 0 && rts->cur_time.tv_nsec == 0) {
 		clock_gettime(CLOCK_MONOTONIC_RAW, &rts->cur_time);
 		tokens = rts->interval * (rts->preload - 1);
 	} else {
@@ -358,11 +377,37 @@ int pinger(struct ping_rts *rts, ping_func_set_st *fset, socket_st *sock)
 	}
 
 resend:
-	i = fset->send_probe(rts, sock, rts->outpack, sizeof(rts->outpack));
+	if (rts->train) {
+		int n = i = fset->send_train(rts, sock);
+
+		if (n > 0) {
+			oom_count = 0;
+			while (n--) {
+				advance_ntransmitted(rts);
+				loss_sent(rts, rts->ntransmitted);
+			}
+			train_sent(rts, i);
+			return rts->interval - tokens;
+		}
+	} else {
+		i = fset->send_probe(rts, sock, rts->sweep ? size_sweep_current(rts->sweep)->outpack :
+					 rts->outpack, sizeof(rts->outpack));
+	}
 
 	if (i == 0) {
 		oom_count = 0;
 		advance_ntransmitted(rts);
+		loss_sent(rts, rts->ntransmitted);
+		if (rts->sweep)
+			size_sweep_sent(rts->sweep, rts->ntransmitted);
+		if (rts->qos)
+			qos_sent(rts, rts->ntransmitted);
+		if (rts->flows)
+			flow_sent(rts, rts->ntransmitted);
+		if (rts->ratesearch) {
+			rate_sent(rts, rts->ntransmitted);
+			return rate_wait(rts);
+		}
 		if (!rts->opt_quiet && rts->opt_flood) {
 			/* Very silly, but without this output with
 			 * high preload or pipe size is very confusing. */
@@ -386,19 +431,24 @@ resend:
 		rts->rtt_addend += (rts->rtt < 8 * 50000 ? rts->rtt / 8 : 50000);
 		if (rts->opt_adaptive)
 			update_interval(rts);
+		if (rts->ratesearch)
+			rate_queue_full(rts);
 		nores_interval = SCHINT(rts->interval / 2);
 		if (nores_interval > 500)
 			nores_interval = 500;
 		oom_count++;
+		rts->loss.queue_retries++;
 		if (oom_count * nores_interval < rts->lingertime)
 			return nores_interval;
 		i = 0;
+		fate = FATE_QUEUE_FULL;
 		/* Fall to hard error. It is to avoid complete deadlock
 		 * on stuck output device even when dealine was not requested.
 		 * Expected timings are screwed up in any case, but we will
 		 * exit some day. :-) */
 	} else if (errno == EAGAIN) {
 		/* Socket buffer is full. */
+		rts->loss.queue_retries++;
 		tokens += rts->interval;
 		return MIN_INTERVAL_MS;
 	} else {
@@ -424,6 +474,14 @@ resend:
 hard_local_error:
 	/* Hard local error. Pretend we sent packet. */
 	advance_ntransmitted(rts);
+	loss_sent(rts, rts->ntransmitted);
+	loss_set(rts, rts->ntransmitted, fate);
+	if (rts->sweep)
+		size_sweep_sent(rts->sweep, rts->ntransmitted);
+	if (rts->qos)
+		qos_sent(rts, rts->ntransmitted);
+	if (rts->flows)
+		flow_sent(rts, rts->ntransmitted);
 
 	if (i == 0 && !rts->opt_quiet) {
 		if (rts->opt_flood)
@@ -548,6 +606,12 @@ void setup(struct ping_rts *rts, socket_st *sock)
 	if (sock->socktype == SOCK_RAW && rts->ident == -1)
 		rts->ident = htons(getpid() & 0xFFFF);
 
+	loss_init(rts);
+	size_sweep_prepare(rts);
+	train_prepare(rts);
+	rate_prepare(rts);
+	qos_prepare(rts);
+
 	set_signal(SIGINT, sigexit);
 	set_signal(SIGALRM, sigexit);
 	set_signal(SIGQUIT, sigstatus);
@@ -715,6 +779,8 @@ int main_loop(struct ping_rts *rts, ping_func_set_st *fset, socket_st *sock,
 				}
 
 				not_ours = fset->parse_reply(rts, sock, &msg, cc, addrbuf, recv_timep);
+				if (rts->train)
+					train_flush(rts);
 			}
 
 			/* See? ... someone runs another ping on this host. */
@@ -737,12 +803,15 @@ int main_loop(struct ping_rts *rts, ping_func_set_st *fset, socket_st *sock,
 int gather_statistics(struct ping_rts *rts, uint8_t *icmph, int icmplen,
 		      int cc, uint16_t seq, int hops,
 		      int csfailed, struct timeval *tv, char *from,
+		      const struct sockaddr *src,
 		      void (*pr_reply)(uint8_t *icmph, int cc), int multicast,
 		      int wrong_source)
 {
 	int dupflag = 0;
 	long triptime = 0;
 	uint8_t *ptr = icmph + icmplen;
+	size_t datalen = rts->sweep ? size_sweep_datalen(rts->sweep, seq) : rts->datalen;
+	struct timeval rx = *tv;
 
 	++rts->nreceived;
 	if (!csfailed)
@@ -780,6 +849,10 @@ restamp:
 		}
 	}
 
+	if (!csfailed)
+		loss_set(rts, seq, triptime > rts->lingertime * 1000L ?
+				   FATE_LATE : FATE_REPLIED);
+
 	if (csfailed) {
 		++rts->nchecksum;
 		--rts->nreceived;
@@ -790,7 +863,22 @@ restamp:
 	} else {
 		rcvd_set(rts, seq);
 		dupflag = 0;
+		if (rts->sweep && rts->timing)
+			size_sweep_reply(rts->sweep, seq, triptime);
+		if (rts->train)
+			train_reply(rts, seq, &rx);
+		if (rts->ratesearch && rts->timing)
+			rate_reply(rts, seq, triptime);
+		if (rts->qos && rts->timing)
+			qos_reply(rts, seq, triptime);
+		if (rts->flows && rts->timing)
+			flow_reply(rts, seq, triptime);
+		if (!rts->broadcast_pings && !rts->multicast)
+			ttl_reply(rts, hops, seq, &rx, triptime);
 	}
+	/* Every responder but the first is a duplicate of the seq. */
+	if (rts->peers && !csfailed)
+		peers_reply(rts, src, seq, triptime);
 	rts->confirm = rts->confirm_flag;
 
 	if (rts->opt_quiet)
@@ -817,7 +905,7 @@ restamp:
 		if (hops >= 0)
 			printf(_(" ttl=%d"), hops);
 
-		if ((size_t)cc < rts->datalen + 8) {
+		if ((size_t)cc < datalen + 8) {
 			printf(_(" (truncated)\n"));
 			return 1;
 		}
@@ -845,12 +933,12 @@ restamp:
 		/* check the data */
 		cp = ((unsigned char *)ptr) + sizeof(struct timeval);
 		dp = &rts->outpack[8 + sizeof(struct timeval)];
-		for (i = sizeof(struct timeval); i < rts->datalen; ++i, ++cp, ++dp) {
+		for (i = sizeof(struct timeval); i < datalen; ++i, ++cp, ++dp) {
 			if (*cp != *dp) {
 				printf(_("\nwrong data byte #%zu should be 0x%x but was 0x%x"),
 				       i, *dp, *cp);
 				cp = (unsigned char *)ptr + sizeof(struct timeval);
-				for (i = sizeof(struct timeval); i < rts->datalen; ++i, ++cp) {
+				for (i = sizeof(struct timeval); i < datalen; ++i, ++cp) {
 					if ((i % 32) == sizeof(struct timeval))
 						printf("\n#%zu\t", i);
 					printf("%x ", *cp);
@@ -887,6 +975,7 @@ int finish(struct ping_rts *rts)
 	char *comma = "";
 
 	tssub(&tv, &rts->start_time);
+	loss_finalize(rts);
 
     if(rts->opt_quiet < 2) /*GGS*/
     {
@@ -947,6 +1036,14 @@ int finish(struct ping_rts *rts)
 				comma, ipg / 1000, ipg % 1000, rts->rtt / 8000, (rts->rtt / 8) % 1000);
 		}
 		putchar('\n');
+		loss_print(rts, stdout, 1);
+		size_sweep_print(rts);
+		train_print(rts);
+		rate_print(rts);
+		qos_print(rts);
+		flow_print(rts);
+		peers_print(rts);
+		ttl_print(rts);
 	}
 	return (!rts->nreceived || (rts->deadline && rts->nreceived < rts->npackets));
 }
@@ -973,11 +1070,13 @@ void status(struct ping_rts *rts)
 			rts->rtt / 8000, (rts->rtt / 8) % 1000, (long)rts->tmax / 1000, (long)rts->tmax % 1000);
 	}
 	fprintf(stderr, "\n");
+	loss_print(rts, stderr, 0);
 }
 
 inline int is_ours(struct ping_rts *rts, socket_st * sock, uint16_t id)
 {
-	return sock->socktype == SOCK_DGRAM || id == rts->ident;
+	return sock->socktype == SOCK_DGRAM || id == rts->ident ||
+	       (rts->flows && flow_is_ours(rts, id));
 }
 
 char *str_interval(int interval)
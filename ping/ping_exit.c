@@ -46,10 +46,13 @@ syntax: -x <exit-cond>
                                   <n>   : only the <n> last pings are reported (default=all)
                                   <s><f>: two characters (optional) overriding successful <s> and unsuccessful <f> ping
                                           characters in the map
+              l     - report loss attribution counters as a comma separated list:
+                      replied,timedout,queuefull,senderror,unreach,exceeded,filtered,other,late
+                      (see ping_loss.c)
               q     - exit condition quisence all output from ping also the output generated after the -q ping option
                       This flag only has effect if any reporting has been reuestes (n,N or m options)
               NOTES:  - n and N are mutually exclusive
-                      - 'n' or 'N' can be combined with 'm' and/or 'c', for any combination the order is always c/n1/n2/m
+                      - 'n' or 'N' can be combined with 'm', 'c' and/or 'l', for any combination the order is always c/n1/n2/l/m
                         where n2 is only output if 'N' was used and then n1=sucess, n2=failures, with 'n' only one count is
                         output as reuested (see 'n' option). Any missing option will also not be output including its separator.
                       - -x can of course be combined with any other ping option, for instance combinations with -c allow
@@ -282,6 +285,13 @@ struct exit_condition *cond = rts->opt_exit_cond;
     report(cond,TRUE , cond->flags & EXIT_REPORT_STATE, "%c", (cond->condition_met ? 'T' : 'F') );
     report(cond,FALSE, cond->flags & EXIT_REPORT_SUCCESS, "%d", get_exit_cond_success(rts->opt_exit_cond));
     report(cond,FALSE, cond->flags & EXIT_REPORT_FAILURES, "%d", get_exit_cond_failures(rts->opt_exit_cond));
+    if(cond->flags & EXIT_REPORT_LOSS)
+    {
+        char lossbuf[DEFAULT_MSG_BUFLEN];
+
+        loss_format(rts, lossbuf, sizeof(lossbuf));
+        report(cond,FALSE, TRUE, "%s", lossbuf);
+    }
     report(cond,FALSE, cond->flags & EXIT_REPORT_MAP, NULL);
     putchar('\n');
 }
@@ -424,6 +434,9 @@ int parse_opt(struct exit_condition *cond, char *arg, int pos)
     case 'q':
         cond->flags |= EXIT_REPORT_SILENT;
         break;
+    case 'l':
+        cond->flags |= EXIT_REPORT_LOSS;
+        break;
     }
 
     return pos;
@@ -34,15 +34,16 @@ struct ping_rts; // Forward definition
 #define EXIT_REPORT_MAP   32  // Report ping map
 #define EXIT_REPORT_SILENT 64 // Report only the exit status information (if any report requested!)
 #define EXIT_REPORT_STATE 128 // Report condition state at exit 'T'/'F'
+#define EXIT_REPORT_LOSS  256 // Report per-class loss counters
 
 #define EXIT_COND_LOC_FLAGS EXIT_SEQUENCE
 
-#define EXIT_REPORT_FLAGS (EXIT_REPORT_SUCCESS | EXIT_REPORT_FAILURES | EXIT_REPORT_MAP | EXIT_REPORT_STATE)
+#define EXIT_REPORT_FLAGS (EXIT_REPORT_SUCCESS | EXIT_REPORT_FAILURES | EXIT_REPORT_MAP | EXIT_REPORT_STATE | EXIT_REPORT_LOSS)
 
 #define EXIT_DEFAULT_SUCCESS_MAP '+'
 #define EXIT_DEFAULT_FAILURE_MAP '-'
 
-#define EXIT_COND_OPTIONS "xnNmqc"
+#define EXIT_COND_OPTIONS "xnNmqcl"
 
 #if DEBUG_MAP_EXTENSION
 #define EXIT_COND_DEFAULT_MAP_SIZE 20
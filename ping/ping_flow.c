@@ -0,0 +1,193 @@
+/*
+ *			P I N G _ F L O W . C
+ *
+ * ECMP path enumeration: a single ping flow hashes onto one member of an
+ * equal cost multipath group, hiding the others.  Rotating the flow key
+ * (IPv6 flow label or ICMP identifier) from probe to probe spreads the
+ * probes over the members, and per-key statistics make a slow or lossy
+ * member stand out.
+ *
+ * Status -
+ *	Public Domain.  Distribution Unlimited.
+ */
+
+#include "ping.h"
+
+#ifndef IPV6_FLOWLABEL_MGR
+# define IPV6_FLOWLABEL_MGR 32
+#endif
+#ifndef IPV6_FLOWINFO_SEND
+# define IPV6_FLOWINFO_SEND 33
+#endif
+
+/* -K [label:|ident:]<count> */
+struct flow_keys *parse_flow_keys(const char *spec)
+{
+	struct flow_keys *fk;
+
+	fk = calloc(1, sizeof(*fk));
+	if (!fk)
+		error(2, errno, _("memory allocation failed"));
+	if (!strncmp(spec, "label:", 6)) {
+		fk->mode = FLOW_LABEL;
+		spec += 6;
+	} else if (!strncmp(spec, "ident:", 6)) {
+		fk->mode = FLOW_IDENT;
+		spec += 6;
+	}
+	fk->nkeys = strtol_or_err(spec, _("bad number of flow keys"), 2, FLOW_MAX_KEYS);
+	fk->keys = calloc(fk->nkeys, sizeof(*fk->keys));
+	if (!fk->keys)
+		error(2, errno, _("memory allocation failed"));
+	return fk;
+}
+
+/* Lease one flow label per key, letting the kernel pick them. */
+static void flow_setup_labels(struct ping_rts *rts, socket_st *sock)
+{
+	struct flow_keys *fk = rts->flows;
+	struct in6_flowlabel_req freq;
+	int on = 1;
+	int i;
+
+	for (i = 0; i < fk->nkeys; i++) {
+		memset(&freq, 0, sizeof(freq));
+		freq.flr_action = IPV6_FL_A_GET;
+		freq.flr_flags = IPV6_FL_F_CREATE;
+		freq.flr_share = IPV6_FL_S_EXCL;
+		memcpy(&freq.flr_dst, &rts->whereto6.sin6_addr, 16);
+		if (setsockopt(sock->fd, IPPROTO_IPV6, IPV6_FLOWLABEL_MGR, &freq, sizeof(freq)) == -1)
+			error(2, errno, _("can't set flowlabel"));
+		fk->keys[i].key = freq.flr_label;
+	}
+	if (setsockopt(sock->fd, IPPROTO_IPV6, IPV6_FLOWINFO_SEND, &on, sizeof on) == -1)
+		error(2, errno, _("can't send flowinfo"));
+}
+
+static void flow_apply(struct ping_rts *rts)
+{
+	struct flow_keys *fk = rts->flows;
+
+	if (fk->mode == FLOW_LABEL)
+		rts->whereto6.sin6_flowinfo = fk->keys[fk->cur].key;
+	else
+		rts->ident = fk->keys[fk->cur].key;
+}
+
+/* Called after setup(), once the socket and the identifier are known. */
+void flow_setup(struct ping_rts *rts, socket_st *sock, int family)
+{
+	struct flow_keys *fk = rts->flows;
+	int i;
+
+	if (!fk || fk->by_seq)
+		return;
+	if (fk->mode == FLOW_DEFAULT)
+		fk->mode = family == AF_INET6 ? FLOW_LABEL : FLOW_IDENT;
+	if (fk->mode == FLOW_LABEL && family != AF_INET6)
+		error(2, 0, _("flow label rotation needs IPv6"));
+	if (fk->mode == FLOW_IDENT && sock->socktype != SOCK_RAW)
+		error(2, 0, _("identifier rotation needs a raw socket, see -e"));
+	if (fk->mode == FLOW_LABEL && rts->opt_flowinfo)
+		error(2, 0, _("-F cannot be used with flow label rotation"));
+
+	fk->by_seq = calloc(MAX_DUP_CHK, sizeof(*fk->by_seq));
+	if (!fk->by_seq)
+		error(2, errno, _("memory allocation failed"));
+	for (i = 0; i < fk->nkeys; i++)
+		rtt_stats_init(&fk->keys[i].rtt);
+
+	if (fk->mode == FLOW_LABEL) {
+		flow_setup_labels(rts, sock);
+	} else {
+		/* Consecutive identifiers from ours on. */
+		fk->ident_base = ntohs(rts->ident);
+		for (i = 0; i < fk->nkeys; i++)
+			fk->keys[i].key = htons((uint16_t)(fk->ident_base + i));
+	}
+	flow_apply(rts);
+}
+
+int flow_is_ours(struct ping_rts *rts, uint16_t id)
+{
+	struct flow_keys *fk = rts->flows;
+
+	return fk->mode == FLOW_IDENT &&
+	       (uint16_t)(ntohs(id) - fk->ident_base) < fk->nkeys;
+}
+
+void flow_sent(struct ping_rts *rts, uint16_t seq)
+{
+	struct flow_keys *fk = rts->flows;
+
+	fk->by_seq[seq % MAX_DUP_CHK] = fk->cur;
+	fk->keys[fk->cur].ntransmitted++;
+	fk->cur = (fk->cur + 1) % fk->nkeys;
+	flow_apply(rts);
+}
+
+void flow_reply(struct ping_rts *rts, uint16_t seq, long triptime)
+{
+	struct flow_keys *fk = rts->flows;
+
+	rtt_stats_add(&fk->keys[fk->by_seq[seq % MAX_DUP_CHK]].rtt, triptime);
+}
+
+/*
+ * A key is flagged with '!' when it loses clearly more than the keys
+ * overall, or when its median rtt is 25% above the median of the medians.
+ */
+void flow_print(struct ping_rts *rts)
+{
+	struct flow_keys *fk = rts->flows;
+	long sent = 0, rcvd = 0, medians[FLOW_MAX_KEYS], mid;
+	int i, j, n = 0;
+
+	if (!fk || !fk->by_seq)
+		return;
+	for (i = 0; i < fk->nkeys; i++) {
+		struct flow_key *k = &fk->keys[i];
+		long m = rtt_stats_percentile(&k->rtt, 50);
+
+		sent += k->ntransmitted;
+		rcvd += k->rtt.count;
+		if (!k->rtt.count)
+			continue;
+		for (j = n++; j > 0 && medians[j - 1] > m; j--)
+			medians[j] = medians[j - 1];
+		medians[j] = m;
+	}
+	mid = n ? medians[n / 2] : 0;
+
+	printf(_("%-10s %6s %6s %5s %9s %9s %9s %9s %9s %9s\n"), _("flow key"),
+	       _("sent"), _("rcvd"), _("loss"), _("min"), _("avg"), _("p50"),
+	       _("p90"), _("p99"), _("max"));
+	for (i = 0; i < fk->nkeys; i++) {
+		struct flow_key *k = &fk->keys[i];
+		long loss = k->ntransmitted ? (k->ntransmitted - k->rtt.count) * 100 / k->ntransmitted : 0;
+		long all = sent ? (sent - rcvd) * 100 / sent : 0;
+		int odd = 0;
+		char name[16];
+
+		if (fk->mode == FLOW_LABEL)
+			snprintf(name, sizeof(name), "0x%05x", (unsigned)ntohl(k->key));
+		else
+			snprintf(name, sizeof(name), "id %u", ntohs(k->key));
+		printf("%-10s %6ld %6ld %4ld%%", name, k->ntransmitted, k->rtt.count, loss);
+		if (k->ntransmitted && loss > 2 * all + 1)
+			odd = 1;
+		if (k->rtt.count) {
+			long p50 = rtt_stats_percentile(&k->rtt, 50);
+
+			rtt_print_ms(k->rtt.min);
+			rtt_print_ms(rtt_stats_avg(&k->rtt));
+			rtt_print_ms(p50);
+			rtt_print_ms(rtt_stats_percentile(&k->rtt, 90));
+			rtt_print_ms(rtt_stats_percentile(&k->rtt, 99));
+			rtt_print_ms(k->rtt.max);
+			if (n > 2 && p50 * 4 > mid * 5)
+				odd = 1;
+		}
+		printf(odd ? " !\n" : "\n");
+	}
+}
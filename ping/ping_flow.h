@@ -0,0 +1,47 @@
+#ifndef IPUTILS_PING_FLOW_H
+#define IPUTILS_PING_FLOW_H
+
+#ifndef IPUTILS_PING_H
+#error ping_flow.h is not to be included directly, but via ping.h
+#endif
+
+#include <stdint.h>
+
+#include "iputils_stats.h"
+
+struct ping_rts;
+struct socket_st;
+
+#define FLOW_MAX_KEYS		256
+
+enum flow_mode {
+	FLOW_DEFAULT,			/* labels for IPv6, idents for IPv4 */
+	FLOW_LABEL,			/* IPv6 flow label */
+	FLOW_IDENT			/* ICMP identifier, raw sockets only */
+};
+
+struct flow_key {
+	uint32_t key;			/* network byte order */
+	long ntransmitted;
+	struct rtt_stats rtt;
+};
+
+/* Probes rotate through a set of flow keys, each hashing onto its own
+ * ECMP member, and statistics are kept per key. */
+struct flow_keys {
+	enum flow_mode mode;
+	int nkeys;
+	int cur;
+	uint16_t ident_base;		/* host byte order */
+	struct flow_key *keys;
+	uint8_t *by_seq;		/* key, by sequence number */
+};
+
+extern struct flow_keys *parse_flow_keys(const char *spec);
+extern void flow_setup(struct ping_rts *rts, struct socket_st *sock, int family);
+extern int flow_is_ours(struct ping_rts *rts, uint16_t id);
+extern void flow_sent(struct ping_rts *rts, uint16_t seq);
+extern void flow_reply(struct ping_rts *rts, uint16_t seq, long triptime);
+extern void flow_print(struct ping_rts *rts);
+
+#endif /* IPUTILS_PING_FLOW_H */
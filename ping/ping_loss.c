@@ -0,0 +1,258 @@
+/*
+ *			P I N G _ L O S S . C
+ *
+ * Loss attribution: classify the fate of every transmitted probe, so that
+ * local problems (full device queue, send errors) can be told apart from
+ * remote ones (ICMP errors, silent drops) at a glance.
+ *
+ * Status -
+ *	Public Domain.  Distribution Unlimited.
+ */
+
+#include "ping.h"
+
+static const char *const fate_names[FATE_MAX] = {
+	[FATE_NONE]		= "unused",
+	[FATE_PENDING]		= "pending",
+	[FATE_REPLIED]		= "replied",
+	[FATE_TIMEDOUT]		= "timed out",
+	[FATE_QUEUE_FULL]	= "queue full",
+	[FATE_SEND_ERROR]	= "send error",
+	[FATE_UNREACH]		= "unreachable",
+	[FATE_EXCEEDED]		= "ttl exceeded",
+	[FATE_FILTERED]		= "filtered",
+	[FATE_ICMP_OTHER]	= "other icmp",
+	[FATE_LATE]		= "late",
+};
+
+static const char *const unreach4_names[LOSS_CODE_MAX] = {
+	"net", "host", "protocol", "port", "frag needed", "source route",
+	"net unknown", "host unknown", "isolated", "net prohibited",
+	"host prohibited", "net tos", "host tos", "filtered",
+	"precedence violation", "precedence cutoff"
+};
+
+static const char *const unreach6_names[LOSS_CODE_MAX] = {
+	"no route", "admin prohibited", "beyond scope", "address", "port",
+	"policy", "reject route"
+};
+
+static const char *const exceeded_names[LOSS_CODE_MAX] = {
+	"in transit", "reassembly"
+};
+
+void loss_init(struct ping_rts *rts)
+{
+	struct loss_stats *ls = &rts->loss;
+
+	if (ls->fate)
+		return;
+	ls->fate = calloc(MAX_DUP_CHK, sizeof(*ls->fate));
+	if (!ls->fate)
+		error(2, errno, _("memory allocation failed"));
+}
+
+void loss_set(struct ping_rts *rts, uint16_t seq, enum probe_fate fate)
+{
+	struct loss_stats *ls = &rts->loss;
+	uint8_t old;
+
+	if (!ls->fate)
+		return;
+	old = ls->fate[seq % MAX_DUP_CHK];
+	if (old == FATE_NONE || old == fate)
+		return;
+	if (old != FATE_PENDING)
+		ls->count[old]--;
+	if (fate != FATE_PENDING)
+		ls->count[fate]++;
+	ls->fate[seq % MAX_DUP_CHK] = fate;
+}
+
+void loss_sent(struct ping_rts *rts, uint16_t seq)
+{
+	struct loss_stats *ls = &rts->loss;
+
+	if (!ls->fate)
+		return;
+	/* Sequence numbers wrapped: a probe still pending is lost for good. */
+	if (ls->fate[seq % MAX_DUP_CHK] == FATE_PENDING)
+		ls->count[FATE_TIMEDOUT]++;
+	ls->fate[seq % MAX_DUP_CHK] = FATE_PENDING;
+}
+
+static int is_filtered(int family, uint8_t code)
+{
+	if (family == AF_INET6)
+		return code == ICMP6_DST_UNREACH_ADMIN ||
+		       code == ICMP6_DST_UNREACH_POLICYFAIL ||
+		       code == ICMP6_DST_UNREACH_REJECTROUTE;
+	return code == ICMP_PKT_FILTERED ||
+	       code == ICMP_NET_ANO ||
+	       code == ICMP_HOST_ANO ||
+	       code == ICMP_PREC_CUTOFF;
+}
+
+void loss_icmp(struct ping_rts *rts, uint16_t seq, int family,
+	       uint8_t type, uint8_t code)
+{
+	struct loss_stats *ls = &rts->loss;
+	enum probe_fate fate = FATE_ICMP_OTHER;
+	int unreach, exceeded;
+
+	ls->family = family;
+	if (family == AF_INET6) {
+		unreach = type == ICMP6_DST_UNREACH;
+		exceeded = type == ICMP6_TIME_EXCEEDED;
+	} else {
+		unreach = type == ICMP_DEST_UNREACH;
+		exceeded = type == ICMP_TIME_EXCEEDED;
+	}
+
+	if (unreach)
+		fate = is_filtered(family, code) ? FATE_FILTERED : FATE_UNREACH;
+	else if (exceeded)
+		fate = FATE_EXCEEDED;
+
+	/* Raw sockets may see the same error both queued and inline. */
+	if (!ls->fate || ls->fate[seq % MAX_DUP_CHK] != FATE_PENDING)
+		return;
+	if (unreach && code < LOSS_CODE_MAX)
+		ls->unreach_code[code]++;
+	else if (exceeded && code < LOSS_CODE_MAX)
+		ls->exceeded_code[code]++;
+	loss_set(rts, seq, fate);
+}
+
+/* Called once from finish(): everything still pending has timed out. */
+void loss_finalize(struct ping_rts *rts)
+{
+	struct loss_stats *ls = &rts->loss;
+	long n, i;
+
+	if (!ls->fate)
+		return;
+	n = rts->ntransmitted < MAX_DUP_CHK ? rts->ntransmitted : MAX_DUP_CHK;
+	for (i = 0; i < n; i++) {
+		uint16_t seq = rts->ntransmitted - i;
+
+		if (ls->fate[seq % MAX_DUP_CHK] == FATE_PENDING)
+			loss_set(rts, seq, FATE_TIMEDOUT);
+	}
+}
+
+int loss_any(struct ping_rts *rts)
+{
+	struct loss_stats *ls = &rts->loss;
+	int i;
+
+	for (i = FATE_TIMEDOUT; i < FATE_MAX; i++)
+		if (ls->count[i])
+			return 1;
+	return ls->queue_retries != 0;
+}
+
+static void print_codes(FILE *out, const long *counts, const char *const *names,
+			int family, int want_filtered)
+{
+	const char *sep = " (";
+	int code;
+
+	for (code = 0; code < LOSS_CODE_MAX; code++) {
+		if (!counts[code])
+			continue;
+		if (want_filtered >= 0 && is_filtered(family, code) != want_filtered)
+			continue;
+		if (names[code])
+			fprintf(out, "%s%s %ld", sep, names[code], counts[code]);
+		else
+			fprintf(out, _("%scode %d %ld"), sep, code, counts[code]);
+		sep = ", ";
+	}
+	if (*sep == ',')
+		fputc(')', out);
+}
+
+static void print_timeline(struct ping_rts *rts, FILE *out)
+{
+	struct loss_stats *ls = &rts->loss;
+	long first, seq, start;
+	int runs = 0;
+	uint8_t cur;
+
+	if (!rts->ntransmitted)
+		return;
+	first = rts->ntransmitted > MAX_DUP_CHK ? rts->ntransmitted - MAX_DUP_CHK + 1 : 1;
+	fprintf(out, _("timeline:"));
+	start = first;
+	cur = ls->fate[first % MAX_DUP_CHK];
+	for (seq = first + 1; seq <= rts->ntransmitted + 1; seq++) {
+		uint8_t f = seq <= rts->ntransmitted ? ls->fate[seq % MAX_DUP_CHK] : FATE_NONE;
+
+		if (f == cur && seq <= rts->ntransmitted)
+			continue;
+		if (runs++ == LOSS_TIMELINE_RUNS) {
+			fprintf(out, " ...");
+			break;
+		}
+		if (start == seq - 1)
+			fprintf(out, " %ld %s", start, fate_names[cur]);
+		else
+			fprintf(out, " %ld-%ld %s", start, seq - 1, fate_names[cur]);
+		if (seq <= rts->ntransmitted)
+			fputc(',', out);
+		start = seq;
+		cur = f;
+	}
+	fputc('\n', out);
+}
+
+/*
+ * Print per-class counters of lost probes, optionally followed by a
+ * run-length encoded timeline of probe fates.
+ */
+void loss_print(struct ping_rts *rts, FILE *out, int timeline)
+{
+	struct loss_stats *ls = &rts->loss;
+	const char *const *unreach_names;
+	const char *sep = "";
+	int i;
+
+	if (!ls->fate || !loss_any(rts))
+		return;
+	unreach_names = ls->family == AF_INET6 ? unreach6_names : unreach4_names;
+
+	fprintf(out, _("loss: "));
+	for (i = FATE_TIMEDOUT; i < FATE_MAX; i++) {
+		if (!ls->count[i])
+			continue;
+		fprintf(out, "%s%ld %s", sep, ls->count[i], fate_names[i]);
+		if (i == FATE_UNREACH)
+			print_codes(out, ls->unreach_code, unreach_names, ls->family, 0);
+		else if (i == FATE_FILTERED)
+			print_codes(out, ls->unreach_code, unreach_names, ls->family, 1);
+		else if (i == FATE_EXCEEDED)
+			print_codes(out, ls->exceeded_code, exceeded_names, ls->family, -1);
+		sep = ", ";
+	}
+	if (ls->queue_retries)
+		fprintf(out, _("%s%ld queue full retries"), sep, ls->queue_retries);
+	fputc('\n', out);
+
+	if (timeline)
+		print_timeline(rts, out);
+}
+
+/*
+ * Machine readable form used by the exit condition report:
+ * replied,timedout,queuefull,senderror,unreach,exceeded,filtered,other,late
+ */
+int loss_format(struct ping_rts *rts, char *buf, size_t len)
+{
+	const long *c = rts->loss.count;
+
+	return snprintf(buf, len, "%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld",
+			c[FATE_REPLIED], c[FATE_TIMEDOUT], c[FATE_QUEUE_FULL],
+			c[FATE_SEND_ERROR], c[FATE_UNREACH], c[FATE_EXCEEDED],
+			c[FATE_FILTERED], c[FATE_ICMP_OTHER], c[FATE_LATE]);
+}
@@ -0,0 +1,54 @@
+#ifndef IPUTILS_PING_LOSS_H
+#define IPUTILS_PING_LOSS_H
+
+#ifndef IPUTILS_PING_H
+#error ping_loss.h is not to be included directly, but via ping.h
+#endif
+
+#include <stdint.h>
+
+struct ping_rts;
+
+/*
+ * What eventually happened to a probe.  Every transmitted sequence number
+ * ends up in exactly one of the final classes, so the counters add up to
+ * the number of transmitted packets once finish() has run.
+ */
+enum probe_fate {
+	FATE_NONE = 0,		/* sequence number not used (yet) */
+	FATE_PENDING,		/* sent, nothing heard back so far */
+	FATE_REPLIED,
+	FATE_TIMEDOUT,
+	FATE_QUEUE_FULL,	/* ENOBUFS/ENOMEM, never left this host */
+	FATE_SEND_ERROR,	/* hard local error */
+	FATE_UNREACH,		/* ICMP destination unreachable */
+	FATE_EXCEEDED,		/* ICMP time exceeded */
+	FATE_FILTERED,		/* ICMP administratively prohibited */
+	FATE_ICMP_OTHER,	/* parameter problem, packet too big, ... */
+	FATE_LATE,		/* reply arrived after the -W timeout */
+	FATE_MAX
+};
+
+#define LOSS_CODE_MAX		16	/* ICMP codes tracked per error type */
+#define LOSS_TIMELINE_RUNS	32	/* runs printed by finish() */
+
+struct loss_stats {
+	uint8_t *fate;			/* enum probe_fate, by sequence number */
+	long count[FATE_MAX];
+	long unreach_code[LOSS_CODE_MAX];
+	long exceeded_code[LOSS_CODE_MAX];
+	long queue_retries;		/* ENOBUFS/EAGAIN retried later */
+	int family;
+};
+
+extern void loss_init(struct ping_rts *rts);
+extern void loss_sent(struct ping_rts *rts, uint16_t seq);
+extern void loss_set(struct ping_rts *rts, uint16_t seq, enum probe_fate fate);
+extern void loss_icmp(struct ping_rts *rts, uint16_t seq, int family,
+		      uint8_t type, uint8_t code);
+extern void loss_finalize(struct ping_rts *rts);
+extern int loss_any(struct ping_rts *rts);
+extern void loss_print(struct ping_rts *rts, FILE *out, int timeline);
+extern int loss_format(struct ping_rts *rts, char *buf, size_t len);
+
+#endif /* IPUTILS_PING_LOSS_H */
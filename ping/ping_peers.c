@@ -0,0 +1,218 @@
+/*
+ *			P I N G _ P E E R S . C
+ *
+ * Per-responder statistics.  A broadcast or multicast ping is answered by
+ * every host on the segment, and the common counters mix them all up.
+ * Here every source address gets its own reply count and rtt statistics,
+ * looked up in a hash table so that thousands of responders cost no more
+ * per reply than one, and finish() prints them sorted by latency or loss.
+ *
+ * Status -
+ *	Public Domain.  Distribution Unlimited.
+ */
+
+#include "ping.h"
+
+#define PEER_MIN_SLOTS		64
+
+/* -P latency|loss */
+struct peer_table *parse_peer_sort(const char *spec)
+{
+	struct peer_table *pt;
+
+	pt = calloc(1, sizeof(*pt));
+	if (!pt)
+		error(2, errno, _("memory allocation failed"));
+	if (!strcmp(spec, "latency"))
+		pt->sort = PEER_SORT_LATENCY;
+	else if (!strcmp(spec, "loss"))
+		pt->sort = PEER_SORT_LOSS;
+	else
+		error(2, 0, _("bad responder sort order, use latency or loss: %s"), spec);
+	return pt;
+}
+
+static void peers_alloc_slots(struct peer_table *pt, size_t nslots)
+{
+	pt->slots = malloc(nslots * sizeof(*pt->slots));
+	if (!pt->slots)
+		error(2, errno, _("memory allocation failed"));
+	memset(pt->slots, 0xff, nslots * sizeof(*pt->slots));
+	pt->nslots = nslots;
+}
+
+/* Per-responder statistics are on by default for broadcast and multicast. */
+void peers_prepare(struct ping_rts *rts)
+{
+	if (!rts->peers && (rts->broadcast_pings || rts->multicast)) {
+		rts->peers = calloc(1, sizeof(*rts->peers));
+		if (!rts->peers)
+			error(2, errno, _("memory allocation failed"));
+	}
+	if (rts->prefix_file && !rts->peers)
+		error(2, 0, _("-G labels the per-responder statistics, it needs -P or a broadcast or multicast target"));
+	if (rts->prefix_file && !rts->prefixes)
+		rts->prefixes = lpm_load(rts->prefix_file);
+	if (!rts->peers || rts->peers->slots)
+		return;
+	peers_alloc_slots(rts->peers, PEER_MIN_SLOTS);
+}
+
+static uint32_t peer_hash(const uint8_t *addr)
+{
+	uint32_t h = 2166136261u, w;
+	int i;
+
+	for (i = 0; i < 16; i += 4) {
+		memcpy(&w, addr + i, sizeof(w));
+		h = (h ^ w) * 16777619u;
+	}
+	return h ^ (h >> 15);
+}
+
+static size_t peer_slot(struct peer_table *pt, const uint8_t *addr, int family)
+{
+	size_t mask = pt->nslots - 1;
+	size_t i = peer_hash(addr) & mask;
+
+	while (pt->slots[i] >= 0) {
+		struct peer *p = &pt->peers[pt->slots[i]];
+
+		if (p->family == family && !memcmp(p->addr, addr, sizeof(p->addr)))
+			break;
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+static void peers_grow(struct peer_table *pt)
+{
+	size_t i;
+
+	free(pt->slots);
+	peers_alloc_slots(pt, pt->nslots * 2);
+	for (i = 0; i < pt->npeers; i++)
+		pt->slots[peer_slot(pt, pt->peers[i].addr, pt->peers[i].family)] = i;
+}
+
+static struct peer *peer_lookup(struct peer_table *pt, const struct sockaddr *src)
+{
+	uint8_t addr[16] = { 0 };
+	struct peer *p;
+	size_t slot;
+
+	if (src->sa_family == AF_INET6)
+		memcpy(addr, &((const struct sockaddr_in6 *)src)->sin6_addr, 16);
+	else
+		memcpy(addr, &((const struct sockaddr_in *)src)->sin_addr, 4);
+
+	slot = peer_slot(pt, addr, src->sa_family);
+	if (pt->slots[slot] >= 0)
+		return &pt->peers[pt->slots[slot]];
+
+	if (pt->npeers == INT32_MAX)
+		return NULL;
+	if (pt->npeers == pt->peers_alloc) {
+		size_t n = pt->peers_alloc ? pt->peers_alloc * 2 : PEER_MIN_SLOTS / 2;
+
+		p = realloc(pt->peers, n * sizeof(*p));
+		if (!p)
+			error(2, errno, _("memory allocation failed"));
+		pt->peers = p;
+		pt->peers_alloc = n;
+	}
+	p = &pt->peers[pt->npeers];
+	memset(p, 0, sizeof(*p));
+	memcpy(p->addr, addr, sizeof(p->addr));
+	p->family = src->sa_family;
+	rtt_stats_init(&p->rtt);
+	pt->slots[slot] = pt->npeers++;
+	if (pt->npeers * 4 > pt->nslots * 3)
+		peers_grow(pt);
+	return &pt->peers[pt->npeers - 1];
+}
+
+void peers_reply(struct ping_rts *rts, const struct sockaddr *src, uint16_t seq,
+		 long triptime)
+{
+	struct peer *p = peer_lookup(rts->peers, src);
+
+	/* A repeated reply from the same host is a true duplicate. */
+	if (!p || (p->rtt.count && p->last_seq == seq))
+		return;
+	p->last_seq = seq;
+	rtt_stats_add(&p->rtt, triptime);
+}
+
+static long peer_loss(const struct peer *p, long sent)
+{
+	return sent > p->rtt.count ? (sent - p->rtt.count) * 100 / sent : 0;
+}
+
+static long peers_sent;
+
+static int peer_cmp_latency(const void *a, const void *b)
+{
+	const struct peer *pa = *(struct peer *const *)a, *pb = *(struct peer *const *)b;
+	long ma = rtt_stats_percentile(&pa->rtt, 50), mb = rtt_stats_percentile(&pb->rtt, 50);
+
+	if (ma != mb)
+		return ma < mb ? -1 : 1;
+	return peer_loss(pa, peers_sent) - peer_loss(pb, peers_sent);
+}
+
+static int peer_cmp_loss(const void *a, const void *b)
+{
+	const struct peer *pa = *(struct peer *const *)a, *pb = *(struct peer *const *)b;
+	long la = peer_loss(pa, peers_sent), lb = peer_loss(pb, peers_sent);
+
+	if (la != lb)
+		return la > lb ? -1 : 1;
+	return peer_cmp_latency(a, b);
+}
+
+void peers_print(struct ping_rts *rts)
+{
+	struct peer_table *pt = rts->peers;
+	struct peer **order;
+	char name[INET6_ADDRSTRLEN];
+	char label[128];
+	size_t i;
+
+	if (!pt || !pt->npeers)
+		return;
+	order = malloc(pt->npeers * sizeof(*order));
+	if (!order)
+		error(2, errno, _("memory allocation failed"));
+	for (i = 0; i < pt->npeers; i++)
+		order[i] = &pt->peers[i];
+	peers_sent = rts->ntransmitted;
+	qsort(order, pt->npeers, sizeof(*order),
+	      pt->sort == PEER_SORT_LOSS ? peer_cmp_loss : peer_cmp_latency);
+
+	printf(_("%zu responders\n"), pt->npeers);
+	printf(_("%-39s %6s %5s %9s %9s %9s %9s %9s %9s"), _("responder"),
+	       _("rcvd"), _("loss"), _("min"), _("avg"), _("p50"), _("p90"),
+	       _("p99"), _("max"));
+	if (rts->prefixes)
+		printf(" %s", _("prefix"));
+	putchar('\n');
+	for (i = 0; i < pt->npeers; i++) {
+		struct peer *p = order[i];
+
+		inet_ntop(p->family, p->addr, name, sizeof(name));
+		printf("%-39s %6ld %4ld%%", name, p->rtt.count, peer_loss(p, peers_sent));
+		if (rts->timing) {
+			rtt_print_ms(p->rtt.min);
+			rtt_print_ms(rtt_stats_avg(&p->rtt));
+			rtt_print_ms(rtt_stats_percentile(&p->rtt, 50));
+			rtt_print_ms(rtt_stats_percentile(&p->rtt, 90));
+			rtt_print_ms(rtt_stats_percentile(&p->rtt, 99));
+			rtt_print_ms(p->rtt.max);
+		}
+		if (rts->prefixes && lpm_label(rts->prefixes, p->family, p->addr, label, sizeof(label)))
+			printf(" %s", label);
+		putchar('\n');
+	}
+	free(order);
+}
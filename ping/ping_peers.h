@@ -0,0 +1,47 @@
+#ifndef IPUTILS_PING_PEERS_H
+#define IPUTILS_PING_PEERS_H
+
+#ifndef IPUTILS_PING_H
+#error ping_peers.h is not to be included directly, but via ping.h
+#endif
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "iputils_stats.h"
+
+struct ping_rts;
+
+enum peer_sort {
+	PEER_SORT_LATENCY,		/* by median rtt, fastest first */
+	PEER_SORT_LOSS			/* by loss, worst first */
+};
+
+struct peer {
+	uint8_t addr[16];		/* IPv4 in the first four bytes */
+	int family;
+	uint16_t last_seq;
+	struct rtt_stats rtt;
+};
+
+/*
+ * Responders of a broadcast or multicast ping.  The slots form an open
+ * addressing table with linear probing over indices into peers[], which
+ * grows by doubling; the table is rebuilt whenever it gets 3/4 full.
+ */
+struct peer_table {
+	enum peer_sort sort;
+	struct peer *peers;
+	size_t npeers;
+	size_t peers_alloc;
+	int32_t *slots;			/* index into peers[], -1 if free */
+	size_t nslots;			/* power of two */
+};
+
+extern struct peer_table *parse_peer_sort(const char *spec);
+extern void peers_prepare(struct ping_rts *rts);
+extern void peers_reply(struct ping_rts *rts, const struct sockaddr *src,
+			uint16_t seq, long triptime);
+extern void peers_print(struct ping_rts *rts);
+
+#endif /* IPUTILS_PING_PEERS_H */
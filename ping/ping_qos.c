@@ -0,0 +1,114 @@
+/*
+ *			P I N G _ Q O S . C
+ *
+ * Per-class QoS comparison: with a list of values given to -Q, probes are
+ * interleaved across the TOS (IPv6 traffic class) values, one class per
+ * probe in turn, so every class is measured over the same time window and
+ * under the same load.  Statistics are kept and printed per class.
+ *
+ * Status -
+ *	Public Domain.  Distribution Unlimited.
+ */
+
+#define _GNU_SOURCE
+
+#include "ping.h"
+
+struct qos_classes *parse_qos_classes(const char *list)
+{
+	struct qos_classes *qc;
+	char *copy, *tok, *save = NULL;
+
+	qc = calloc(1, sizeof(*qc));
+	copy = strdup(list);
+	if (!qc || !copy)
+		error(2, errno, _("memory allocation failed"));
+	for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (qc->nclasses == QOS_MAX_CLASSES)
+			error(2, 0, _("too many TOS classes, at most %d"), QOS_MAX_CLASSES);
+		qc->cls[qc->nclasses].tos = parsetos(tok);
+		rtt_stats_init(&qc->cls[qc->nclasses].rtt);
+		qc->nclasses++;
+	}
+	if (qc->nclasses < 2)
+		error(2, 0, _("bad TOS class list: %s"), list);
+	free(copy);
+	return qc;
+}
+
+void qos_prepare(struct ping_rts *rts)
+{
+	struct qos_classes *qc = rts->qos;
+
+	if (!qc || qc->by_seq)
+		return;
+	qc->by_seq = calloc(MAX_DUP_CHK, sizeof(*qc->by_seq));
+	if (!qc->by_seq)
+		error(2, errno, _("memory allocation failed"));
+}
+
+/* Write the TOS cmsg of the current class to buf, return the space used. */
+size_t qos_cmsg(struct ping_rts *rts, int family, void *buf, size_t len)
+{
+	struct cmsghdr *cmsg = buf;
+	int tos = rts->qos->cls[rts->qos->cur].tos;
+
+	if (len < CMSG_SPACE(sizeof(tos)))
+		return 0;
+	memset(buf, 0, CMSG_SPACE(sizeof(tos)));
+	cmsg->cmsg_len = CMSG_LEN(sizeof(tos));
+	if (family == AF_INET6) {
+		cmsg->cmsg_level = IPPROTO_IPV6;
+		cmsg->cmsg_type = IPV6_TCLASS;
+	} else {
+		cmsg->cmsg_level = IPPROTO_IP;
+		cmsg->cmsg_type = IP_TOS;
+	}
+	memcpy(CMSG_DATA(cmsg), &tos, sizeof(tos));
+	return CMSG_SPACE(sizeof(tos));
+}
+
+void qos_sent(struct ping_rts *rts, uint16_t seq)
+{
+	struct qos_classes *qc = rts->qos;
+
+	qc->by_seq[seq % MAX_DUP_CHK] = qc->cur;
+	qc->cls[qc->cur].ntransmitted++;
+	qc->cur = (qc->cur + 1) % qc->nclasses;
+}
+
+void qos_reply(struct ping_rts *rts, uint16_t seq, long triptime)
+{
+	struct qos_classes *qc = rts->qos;
+
+	rtt_stats_add(&qc->cls[qc->by_seq[seq % MAX_DUP_CHK]].rtt, triptime);
+}
+
+void qos_print(struct ping_rts *rts)
+{
+	struct qos_classes *qc = rts->qos;
+	int i;
+
+	if (!qc)
+		return;
+	printf(_("%-9s %6s %6s %5s %9s %9s %9s %9s %9s %9s\n"), _("tos/dscp"),
+	       _("sent"), _("rcvd"), _("loss"), _("min"), _("avg"), _("p50"),
+	       _("p90"), _("p99"), _("max"));
+	for (i = 0; i < qc->nclasses; i++) {
+		struct qos_class *c = &qc->cls[i];
+		char name[16];
+
+		snprintf(name, sizeof(name), "0x%02x/%d", c->tos, c->tos >> 2);
+		printf("%-9s %6ld %6ld %4ld%%", name, c->ntransmitted, c->rtt.count,
+		       c->ntransmitted ? (c->ntransmitted - c->rtt.count) * 100 / c->ntransmitted : 0);
+		if (c->rtt.count) {
+			rtt_print_ms(c->rtt.min);
+			rtt_print_ms(rtt_stats_avg(&c->rtt));
+			rtt_print_ms(rtt_stats_percentile(&c->rtt, 50));
+			rtt_print_ms(rtt_stats_percentile(&c->rtt, 90));
+			rtt_print_ms(rtt_stats_percentile(&c->rtt, 99));
+			rtt_print_ms(c->rtt.max);
+		}
+		putchar('\n');
+	}
+}
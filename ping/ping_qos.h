@@ -0,0 +1,37 @@
+#ifndef IPUTILS_PING_QOS_H
+#define IPUTILS_PING_QOS_H
+
+#ifndef IPUTILS_PING_H
+#error ping_qos.h is not to be included directly, but via ping.h
+#endif
+
+#include <stdint.h>
+
+#include "iputils_stats.h"
+
+struct ping_rts;
+
+#define QOS_MAX_CLASSES		16
+
+struct qos_class {
+	int tos;			/* IPv4 TOS or IPv6 traffic class */
+	long ntransmitted;
+	struct rtt_stats rtt;
+};
+
+/* Probes cycle through the classes, each carrying its own IP_TOS cmsg. */
+struct qos_classes {
+	int nclasses;
+	int cur;			/* class of the next probe */
+	struct qos_class cls[QOS_MAX_CLASSES];
+	uint8_t *by_seq;		/* class, by sequence number */
+};
+
+extern struct qos_classes *parse_qos_classes(const char *list);
+extern void qos_prepare(struct ping_rts *rts);
+extern size_t qos_cmsg(struct ping_rts *rts, int family, void *buf, size_t len);
+extern void qos_sent(struct ping_rts *rts, uint16_t seq);
+extern void qos_reply(struct ping_rts *rts, uint16_t seq, long triptime);
+extern void qos_print(struct ping_rts *rts);
+
+#endif /* IPUTILS_PING_QOS_H */
@@ -0,0 +1,263 @@
+/*
+ *			P I N G _ R A T E . C
+ *
+ * Maximum safe probe rate discovery.  The send rate is doubled step by
+ * step until a step loses more than the allowed share of probes, sees its
+ * median rtt inflate past the allowed factor over the baseline, or runs
+ * into a full device queue; the breaking point is then bisected against
+ * the last good rate.  Every step is followed by a quiet period, so its
+ * late replies and queues do not leak into the next one.
+ *
+ * Status -
+ *	Public Domain.  Distribution Unlimited.
+ */
+
+#include "ping.h"
+
+/* -E <loss%>[,<rtt factor>] */
+struct rate_search *parse_rate_search(const char *spec)
+{
+	struct rate_search *rs;
+	char *copy, *factor;
+
+	rs = calloc(1, sizeof(*rs));
+	copy = strdup(spec);
+	if (!rs || !copy)
+		error(2, errno, _("memory allocation failed"));
+	factor = strchr(copy, ',');
+	if (factor)
+		*factor++ = '\0';
+	rs->max_loss = ping_strtod(copy, _("bad rate search loss threshold"));
+	rs->max_inflation = factor ? ping_strtod(factor, _("bad rate search rtt factor")) : 2.0;
+	if (rs->max_loss < 0 || rs->max_loss >= 100)
+		error(2, 0, _("rate search loss threshold must be in range 0-100: %s"), copy);
+	if (rs->max_inflation < 1)
+		error(2, 0, _("rate search rtt factor must be at least 1: %s"), factor);
+	free(copy);
+	return rs;
+}
+
+static long ts_diff_ms(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000 + (a->tv_nsec - b->tv_nsec) / 1000000;
+}
+
+static void ts_add_ns(struct timespec *ts, long ns)
+{
+	ts->tv_nsec += ns;
+	while (ts->tv_nsec >= 1000000000L) {
+		ts->tv_nsec -= 1000000000L;
+		ts->tv_sec++;
+	}
+}
+
+static void rate_step_start(struct ping_rts *rts, long pps)
+{
+	struct rate_search *rs = rts->ratesearch;
+	struct rate_step *st;
+
+	if (rs->nsteps == RATE_MAX_STEPS) {
+		rs->phase = RATE_DONE;
+		return;
+	}
+	st = &rs->steps[rs->nsteps++];
+	st->pps = pps;
+	st->target = pps * RATE_STEP_MS / 1000;
+	if (st->target < RATE_STEP_MIN_PROBES)
+		st->target = RATE_STEP_MIN_PROBES;
+	rtt_stats_init(&st->rtt);
+	/* Keep the ENOBUFS back-off and the statistics line consistent. */
+	rts->interval = 1000 / pps;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &rs->next_due);
+}
+
+void rate_prepare(struct ping_rts *rts)
+{
+	struct rate_search *rs = rts->ratesearch;
+	long pps;
+
+	if (!rs || rs->by_seq)
+		return;
+	rs->by_seq = calloc(MAX_DUP_CHK, sizeof(*rs->by_seq));
+	if (!rs->by_seq)
+		error(2, errno, _("memory allocation failed"));
+	rs->max_pps = rts->uid ? 1000 / MIN_USER_INTERVAL_MS : RATE_MAX_PPS;
+	pps = rts->opt_interval && rts->interval ? 1000 / rts->interval : RATE_START_PPS;
+	if (pps < 1)
+		pps = 1;
+	if (pps > rs->max_pps)
+		pps = rs->max_pps;
+	rs->phase = RATE_RAMP;
+	rate_step_start(rts, pps);
+	/* Steps are paced here, never wait longer than asked for. */
+	rts->opt_flood_poll = 1;
+}
+
+static int rate_step_passed(struct rate_search *rs, struct rate_step *st)
+{
+	long median = rtt_stats_percentile(&st->rtt, 50);
+	double loss = (st->sent - st->rtt.count) * 100.0 / st->sent;
+
+	if (st->rtt.count && (!rs->baseline || median < rs->baseline))
+		rs->baseline = median;
+	if (!st->rtt.count || loss > rs->max_loss || st->queue_full)
+		return 0;
+	return median <= rs->baseline * rs->max_inflation;
+}
+
+static void rate_step_print(struct ping_rts *rts, struct rate_step *st, int passed)
+{
+	struct rate_search *rs = rts->ratesearch;
+	long median = rtt_stats_percentile(&st->rtt, 50);
+
+	if (rts->opt_quiet > 1)
+		return;
+	printf(_("rate %ld pps: %ld/%ld replies, %.1f%% loss"), st->pps, st->rtt.count,
+	       st->sent, (st->sent - st->rtt.count) * 100.0 / st->sent);
+	if (st->rtt.count)
+		printf(_(", median %ld.%03ld ms (x%.2f)"), median / 1000, median % 1000,
+		       rs->baseline ? (double)median / rs->baseline : 1.0);
+	if (st->queue_full)
+		printf(_(", %ld queue full"), st->queue_full);
+	printf(passed ? _(" - ok\n") : _(" - too fast\n"));
+	fflush(stdout);
+}
+
+/* Judge the step that just settled and pick the rate of the next one. */
+static void rate_next(struct ping_rts *rts)
+{
+	struct rate_search *rs = rts->ratesearch;
+	struct rate_step *st = &rs->steps[rs->nsteps - 1];
+	int passed = rate_step_passed(rs, st);
+	long next;
+
+	rate_step_print(rts, st, passed);
+	if (passed) {
+		if (st->pps > rs->good)
+			rs->good = st->pps;
+	} else if (!rs->bad || st->pps < rs->bad) {
+		rs->bad = st->pps;
+		rs->bad_step = rs->nsteps - 1;
+	}
+
+	if (rs->resume == RATE_RAMP && passed) {
+		if (st->pps >= rs->max_pps) {
+			rs->phase = RATE_DONE;
+			return;
+		}
+		next = st->pps * 2 < rs->max_pps ? st->pps * 2 : rs->max_pps;
+	} else {
+		rs->resume = RATE_SEARCH;
+		/* Stop once the bracket is within 10%. */
+		if (!rs->good || rs->bad - rs->good <= (rs->good / 10 > 1 ? rs->good / 10 : 1)) {
+			rs->phase = RATE_DONE;
+			return;
+		}
+		next = (rs->good + rs->bad) / 2;
+	}
+	rs->phase = rs->resume;
+	rate_step_start(rts, next);
+}
+
+/*
+ * Replaces the token bucket of pinger() in rate search mode.  Returns the
+ * number of msec until the next probe is due, 0 to send now.
+ */
+int rate_wait(struct ping_rts *rts)
+{
+	struct rate_search *rs = rts->ratesearch;
+	struct rate_step *st;
+	struct timespec now;
+	long ms;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	if (rs->phase == RATE_SETTLE) {
+		ms = ts_diff_ms(&rs->settle_until, &now);
+		if (ms > 0)
+			return ms;
+		rate_next(rts);
+	}
+	if (rs->phase == RATE_DONE) {
+		rts->exiting = 1;
+		return 1000;
+	}
+
+	st = &rs->steps[rs->nsteps - 1];
+	if (st->sent >= st->target) {
+		ms = 4 * st->rtt.max / 1000;
+		if (ms < RATE_SETTLE_MIN_MS)
+			ms = RATE_SETTLE_MIN_MS;
+		if (ms > rts->lingertime)
+			ms = rts->lingertime;
+		rs->settle_until = now;
+		ts_add_ns(&rs->settle_until, ms * 1000000);
+		rs->resume = rs->phase;
+		rs->phase = RATE_SETTLE;
+		return ms;
+	}
+
+	ms = ts_diff_ms(&rs->next_due, &now);
+	if (ms > 0)
+		return ms;
+	/* Do not make up for a long stall with a burst. */
+	if (ms < -10)
+		rs->next_due = now;
+	rts->cur_time = now;
+	return 0;
+}
+
+void rate_sent(struct ping_rts *rts, uint16_t seq)
+{
+	struct rate_search *rs = rts->ratesearch;
+	struct rate_step *st = &rs->steps[rs->nsteps - 1];
+
+	st->sent++;
+	rs->by_seq[seq % MAX_DUP_CHK] = rs->nsteps;
+	ts_add_ns(&rs->next_due, 1000000000L / st->pps);
+}
+
+void rate_queue_full(struct ping_rts *rts)
+{
+	struct rate_search *rs = rts->ratesearch;
+
+	rs->steps[rs->nsteps - 1].queue_full++;
+}
+
+void rate_reply(struct ping_rts *rts, uint16_t seq, long triptime)
+{
+	struct rate_search *rs = rts->ratesearch;
+	int step = rs->by_seq[seq % MAX_DUP_CHK];
+
+	if (step)
+		rtt_stats_add(&rs->steps[step - 1].rtt, triptime);
+}
+
+void rate_print(struct ping_rts *rts)
+{
+	struct rate_search *rs = rts->ratesearch;
+	struct rate_step *st;
+
+	if (!rs)
+		return;
+	if (rs->good)
+		printf(_("rate search: %d steps, sustainable %ld pps"), rs->nsteps, rs->good);
+	else
+		printf(_("rate search: %d steps, no sustainable rate"), rs->nsteps);
+	if (!rs->bad) {
+		if (rs->phase == RATE_DONE)
+			printf(_(", no breakdown up to %ld pps"), rs->max_pps);
+		putchar('\n');
+		return;
+	}
+
+	st = &rs->steps[rs->bad_step];
+	printf(_(", breaks down at %ld pps:"), st->pps);
+	if (st->queue_full)
+		printf(_(" local queue full"));
+	else if (!st->rtt.count || (st->sent - st->rtt.count) * 100.0 / st->sent > rs->max_loss)
+		printf(_(" %.1f%% loss"), (st->sent - st->rtt.count) * 100.0 / st->sent);
+	else
+		printf(_(" median rtt x%.2f"),
+		       (double)rtt_stats_percentile(&st->rtt, 50) / rs->baseline);
+	putchar('\n');
+}
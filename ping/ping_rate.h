@@ -0,0 +1,62 @@
+#ifndef IPUTILS_PING_RATE_H
+#define IPUTILS_PING_RATE_H
+
+#ifndef IPUTILS_PING_H
+#error ping_rate.h is not to be included directly, but via ping.h
+#endif
+
+#include <stdint.h>
+#include <time.h>
+
+#include "iputils_stats.h"
+
+struct ping_rts;
+
+#define RATE_MAX_STEPS		64
+#define RATE_STEP_MS		1000	/* duration of one step */
+#define RATE_STEP_MIN_PROBES	20
+#define RATE_START_PPS		10
+#define RATE_MAX_PPS		100000
+#define RATE_SETTLE_MIN_MS	200	/* quiet time between steps */
+
+enum rate_phase {
+	RATE_RAMP,			/* doubling until something breaks */
+	RATE_SEARCH,			/* bisecting between good and bad */
+	RATE_SETTLE,			/* waiting for the replies of a step */
+	RATE_DONE
+};
+
+struct rate_step {
+	long pps;
+	long target;			/* probes to send in this step */
+	long sent;
+	long queue_full;		/* ENOBUFS while sending */
+	struct rtt_stats rtt;
+};
+
+struct rate_search {
+	double max_loss;		/* percent */
+	double max_inflation;		/* median rtt over baseline median */
+	enum rate_phase phase;
+	enum rate_phase resume;		/* phase after RATE_SETTLE */
+	long max_pps;
+	long good;			/* highest rate that passed, 0 = none */
+	long bad;			/* lowest rate that failed, 0 = none */
+	long baseline;			/* usec, lowest step median so far */
+	int nsteps;
+	int bad_step;
+	struct rate_step steps[RATE_MAX_STEPS];
+	uint8_t *by_seq;		/* step, by sequence number */
+	struct timespec next_due;
+	struct timespec settle_until;
+};
+
+extern struct rate_search *parse_rate_search(const char *spec);
+extern void rate_prepare(struct ping_rts *rts);
+extern int rate_wait(struct ping_rts *rts);
+extern void rate_sent(struct ping_rts *rts, uint16_t seq);
+extern void rate_queue_full(struct ping_rts *rts);
+extern void rate_reply(struct ping_rts *rts, uint16_t seq, long triptime);
+extern void rate_print(struct ping_rts *rts);
+
+#endif /* IPUTILS_PING_RATE_H */
@@ -0,0 +1,289 @@
+/*
+ *			P I N G _ S W E E P . C
+ *
+ * Packet size sweep and IMIX probing: instead of a fixed -s size, every
+ * probe takes its size from a list, a linear or logarithmic range, or a
+ * weighted mix.  Round trip times are kept per size, and the minimum rtt
+ * of each size is fitted against the size to estimate the bottleneck
+ * bandwidth of the path.
+ *
+ * Status -
+ *	Public Domain.  Distribution Unlimited.
+ */
+
+#include "ping.h"
+
+/* Simple IMIX (7:4:1), as close to 40/576/1500 byte IPv4 packets as a
+ * timestamped probe allows. */
+static const struct {
+	size_t datalen;
+	int weight;
+} imix_default[] = {
+	{ sizeof(struct timeval), 7 },
+	{ 576 - 28, 4 },
+	{ 1500 - 28, 1 },
+};
+
+static size_t parse_size(const char *spec, const char *p, char **end)
+{
+	unsigned long v;
+
+	errno = 0;
+	v = strtoul(p, end, 10);
+	if (errno || *end == p)
+		error(2, 0, _("bad size sweep: %s"), spec);
+	if (v < sizeof(struct timeval) || v > 0xFFFF - 8 - 20)
+		error(2, 0, _("size sweep: sizes must be in range %zu-%d: %lu"),
+		      sizeof(struct timeval), 0xFFFF - 8 - 20, v);
+	return v;
+}
+
+static void add_size(struct size_sweep *sw, size_t datalen, int weight)
+{
+	struct size_probe *sp;
+
+	/* A logarithmic range may round adjacent steps to the same size. */
+	if (sw->nsizes && sw->sizes[sw->nsizes - 1].datalen == datalen &&
+	    sw->mode != SWEEP_IMIX)
+		return;
+	if (sw->nsizes == SWEEP_MAX_SIZES)
+		error(2, 0, _("size sweep: too many sizes, at most %d"), SWEEP_MAX_SIZES);
+	sp = &sw->sizes[sw->nsizes++];
+	sp->datalen = datalen;
+	sp->weight = weight;
+	rtt_stats_init(&sp->rtt);
+	sw->total_weight += weight;
+	if (datalen > sw->maxlen)
+		sw->maxlen = datalen;
+}
+
+/*
+ * Size specification, all sizes in data bytes as for -s:
+ *	64,512,1400		cycle through the list
+ *	lin:64-1472/64		linear range with a step of 64 bytes
+ *	log:64-8192/8		8 sizes spaced geometrically
+ *	imix[:40/7,576/4,...]	weighted mix, size/weight
+ */
+struct size_sweep *parse_size_sweep(const char *spec)
+{
+	struct size_sweep *sw;
+	const char *p = spec;
+	char *end;
+
+	sw = calloc(1, sizeof(*sw));
+	if (sw)
+		sw->sizes = calloc(SWEEP_MAX_SIZES, sizeof(*sw->sizes));
+	if (!sw || !sw->sizes)
+		error(2, errno, _("memory allocation failed"));
+
+	if (!strncmp(p, "lin:", 4) || !strncmp(p, "log:", 4)) {
+		size_t min, max;
+		unsigned long n;
+
+		sw->mode = *(p + 1) == 'i' ? SWEEP_LINEAR : SWEEP_LOG;
+		min = parse_size(spec, p + 4, &end);
+		if (*end != '-')
+			error(2, 0, _("bad size sweep: %s"), spec);
+		max = parse_size(spec, end + 1, &end);
+		if (max < min || *end != '/')
+			error(2, 0, _("bad size sweep: %s"), spec);
+		n = strtoul_or_err(end + 1, _("bad size sweep step"), 1, SWEEP_MAX_SIZES * 64);
+
+		if (sw->mode == SWEEP_LINEAR) {
+			size_t s;
+
+			for (s = min; s <= max; s += n)
+				add_size(sw, s, 1);
+		} else {
+			double ratio;
+			unsigned long i;
+
+			if (n < 2)
+				error(2, 0, _("size sweep: a logarithmic range needs at least 2 sizes"));
+			ratio = log((double)max / min) / (n - 1);
+			for (i = 0; i < n; i++)
+				add_size(sw, (size_t)(min * exp(ratio * i) + 0.5), 1);
+		}
+	} else if (!strncmp(p, "imix", 4)) {
+		sw->mode = SWEEP_IMIX;
+		p += 4;
+		if (!*p) {
+			size_t i;
+
+			for (i = 0; i < ARRAY_SIZE(imix_default); i++)
+				add_size(sw, imix_default[i].datalen, imix_default[i].weight);
+		} else if (*p++ == ':') {
+			do {
+				size_t s = parse_size(spec, p, &end);
+				long w = 1;
+
+				if (*end == '/') {
+					p = end + 1;
+					errno = 0;
+					w = strtol(p, &end, 10);
+					if (errno || end == p || w < 1 || w > 1000)
+						error(2, 0, _("size sweep: bad weight: %s"), spec);
+				}
+				add_size(sw, s, w);
+				p = end + 1;
+			} while (*end == ',');
+			if (*end)
+				error(2, 0, _("bad size sweep: %s"), spec);
+		} else {
+			error(2, 0, _("bad size sweep: %s"), spec);
+		}
+	} else {
+		sw->mode = SWEEP_LIST;
+		do {
+			add_size(sw, parse_size(spec, p, &end), 1);
+			p = end + 1;
+		} while (*end == ',');
+		if (*end)
+			error(2, 0, _("bad size sweep: %s"), spec);
+	}
+
+	return sw;
+}
+
+static void next_size(struct size_sweep *sw)
+{
+	struct size_probe *best = NULL;
+	int i;
+
+	if (sw->mode != SWEEP_IMIX) {
+		sw->cur = (sw->cur + 1) % sw->nsizes;
+		return;
+	}
+	/* Smooth weighted round robin: exact proportions, evenly spread. */
+	for (i = 0; i < sw->nsizes; i++) {
+		struct size_probe *sp = &sw->sizes[i];
+
+		sp->current += sp->weight;
+		if (!best || sp->current > best->current)
+			best = sp;
+	}
+	best->current -= sw->total_weight;
+	sw->cur = best - sw->sizes;
+}
+
+/*
+ * Build the probe pool once the payload pattern is in rts->outpack.  The
+ * pattern does not depend on the size, so every pool buffer is a prefix of
+ * the largest one and replies can still be checked against rts->outpack.
+ */
+void size_sweep_prepare(struct ping_rts *rts)
+{
+	struct size_sweep *sw = rts->sweep;
+	int i;
+
+	if (!sw || sw->by_seq)
+		return;
+	sw->by_seq = calloc(MAX_DUP_CHK, sizeof(*sw->by_seq));
+	if (!sw->by_seq)
+		error(2, errno, _("memory allocation failed"));
+	for (i = 0; i < sw->nsizes; i++) {
+		struct size_probe *sp = &sw->sizes[i];
+
+		sp->outpack = malloc(sp->datalen + 28);
+		if (!sp->outpack)
+			error(2, errno, _("memory allocation failed"));
+		memcpy(sp->outpack, rts->outpack, sp->datalen + 8);
+	}
+	if (sw->mode == SWEEP_IMIX)
+		next_size(sw);
+}
+
+struct size_probe *size_sweep_current(struct size_sweep *sw)
+{
+	return &sw->sizes[sw->cur];
+}
+
+/* Data length of the probe about to be sent. */
+size_t probe_datalen(struct ping_rts *rts)
+{
+	if (rts->sweep)
+		return rts->sweep->sizes[rts->sweep->cur].datalen;
+	return rts->datalen;
+}
+
+/* Account the current probe to seq and pick the size of the next one. */
+void size_sweep_sent(struct size_sweep *sw, uint16_t seq)
+{
+	sw->by_seq[seq % MAX_DUP_CHK] = sw->cur;
+	sw->sizes[sw->cur].ntransmitted++;
+	next_size(sw);
+}
+
+size_t size_sweep_datalen(struct size_sweep *sw, uint16_t seq)
+{
+	return sw->sizes[sw->by_seq[seq % MAX_DUP_CHK]].datalen;
+}
+
+void size_sweep_reply(struct size_sweep *sw, uint16_t seq, long triptime)
+{
+	rtt_stats_add(&sw->sizes[sw->by_seq[seq % MAX_DUP_CHK]].rtt, triptime);
+}
+
+/*
+ * Least squares fit of the per-size minimum rtt against the size.  The
+ * minimum filters out queueing, what is left grows with the serialization
+ * delay of every store-and-forward hop, twice since the reply has the same
+ * size as the request.
+ */
+static void print_regression(struct size_sweep *sw)
+{
+	double sx = 0, sy = 0, sxx = 0, sxy = 0, d, slope, icept;
+	int i, n = 0;
+
+	for (i = 0; i < sw->nsizes; i++) {
+		struct size_probe *sp = &sw->sizes[i];
+
+		if (!sp->rtt.count)
+			continue;
+		sx += sp->datalen;
+		sy += sp->rtt.min;
+		sxx += (double)sp->datalen * sp->datalen;
+		sxy += (double)sp->datalen * sp->rtt.min;
+		n++;
+	}
+	d = n * sxx - sx * sx;
+	if (n < 2 || d <= 0)
+		return;
+	slope = (n * sxy - sx * sy) / d;
+	icept = (sy - slope * sx) / n;
+
+	printf(_("rtt/size fit: %.4f us/byte, base %.3f ms"), slope, icept / 1000);
+	if (slope > 0)
+		printf(_(", bottleneck ~%.1f Mbit/s\n"), 2 * 8 / slope);
+	else
+		printf(_(", no bandwidth estimate\n"));
+}
+
+void size_sweep_print(struct ping_rts *rts)
+{
+	struct size_sweep *sw = rts->sweep;
+	int i;
+
+	if (!sw)
+		return;
+	printf(_("%6s %8s %8s %6s  %s\n"), _("size"), _("sent"), _("rcvd"), _("loss"),
+	       _("rtt min/avg/max/mdev"));
+	for (i = 0; i < sw->nsizes; i++) {
+		struct size_probe *sp = &sw->sizes[i];
+		long avg, mdev;
+
+		if (!sp->ntransmitted)
+			continue;
+		printf("%6zu %8ld %8ld %5ld%%", sp->datalen, sp->ntransmitted, sp->rtt.count,
+		       (sp->ntransmitted - sp->rtt.count) * 100 / sp->ntransmitted);
+		if (sp->rtt.count) {
+			avg = rtt_stats_avg(&sp->rtt);
+			mdev = rtt_stats_mdev(&sp->rtt);
+			printf("  %ld.%03ld/%ld.%03ld/%ld.%03ld/%ld.%03ld ms",
+			       sp->rtt.min / 1000, sp->rtt.min % 1000, avg / 1000, avg % 1000,
+			       sp->rtt.max / 1000, sp->rtt.max % 1000, mdev / 1000, mdev % 1000);
+		}
+		putchar('\n');
+	}
+	print_regression(sw);
+}
@@ -0,0 +1,58 @@
+#ifndef IPUTILS_PING_SWEEP_H
+#define IPUTILS_PING_SWEEP_H
+
+#ifndef IPUTILS_PING_H
+#error ping_sweep.h is not to be included directly, but via ping.h
+#endif
+
+#include <stdint.h>
+
+#include "iputils_stats.h"
+
+struct ping_rts;
+
+enum sweep_mode {
+	SWEEP_LIST,		/* cycle through the given sizes */
+	SWEEP_LINEAR,		/* min-max in fixed steps */
+	SWEEP_LOG,		/* min-max in geometric steps */
+	SWEEP_IMIX		/* weighted mix */
+};
+
+#define SWEEP_MAX_SIZES		1024
+
+/*
+ * One entry of the size-indexed probe pool.  The payload is filled once in
+ * setup(); for IPv4 the checksum of everything behind the timestamp is
+ * cached too, so a probe costs a header-sized checksum regardless of size.
+ */
+struct size_probe {
+	size_t datalen;
+	unsigned char *outpack;
+	unsigned short csum;		/* folded sum of the payload after the timeval */
+	int csum_valid;
+	int weight;
+	int current;			/* smooth weighted round robin state */
+	long ntransmitted;
+	struct rtt_stats rtt;
+};
+
+struct size_sweep {
+	enum sweep_mode mode;
+	int nsizes;
+	int cur;			/* pool entry of the next probe */
+	int total_weight;
+	size_t maxlen;
+	struct size_probe *sizes;
+	uint16_t *by_seq;		/* pool entry, by sequence number */
+};
+
+extern struct size_sweep *parse_size_sweep(const char *spec);
+extern void size_sweep_prepare(struct ping_rts *rts);
+extern struct size_probe *size_sweep_current(struct size_sweep *sw);
+extern void size_sweep_sent(struct size_sweep *sw, uint16_t seq);
+extern size_t probe_datalen(struct ping_rts *rts);
+extern size_t size_sweep_datalen(struct size_sweep *sw, uint16_t seq);
+extern void size_sweep_reply(struct size_sweep *sw, uint16_t seq, long triptime);
+extern void size_sweep_print(struct ping_rts *rts);
+
+#endif /* IPUTILS_PING_SWEEP_H */
@@ -0,0 +1,276 @@
+/*
+ *			P I N G _ T R A I N . C
+ *
+ * Packet train mode: every interval, send a train of back-to-back probes
+ * with a single sendmmsg() call.  The bottleneck link spaces the packets
+ * out to its own serialization rate, and the replies keep that spacing,
+ * so the dispersion of the reply arrival times gives an estimate of the
+ * path capacity.  A train of two is the classic packet pair.
+ *
+ * Status -
+ *	Public Domain.  Distribution Unlimited.
+ */
+
+#define _GNU_SOURCE
+
+#include "ping.h"
+
+struct train_state *parse_train(const char *arg)
+{
+	struct train_state *tr;
+
+	tr = calloc(1, sizeof(*tr));
+	if (!tr)
+		error(2, errno, _("memory allocation failed"));
+	tr->len = strtol_or_err(arg, _("bad train length"), 2, TRAIN_MAX_LEN);
+	return tr;
+}
+
+/* Allocate the train buffers once the payload pattern is in rts->outpack. */
+void train_prepare(struct ping_rts *rts)
+{
+	struct train_state *tr = rts->train;
+	int i;
+
+	if (!tr || tr->by_seq)
+		return;
+	tr->by_seq = calloc(MAX_DUP_CHK, sizeof(*tr->by_seq));
+	tr->estimates = calloc(TRAIN_MAX_ESTIMATES, sizeof(*tr->estimates));
+	if (!tr->by_seq || !tr->estimates)
+		error(2, errno, _("memory allocation failed"));
+	for (i = 0; i < tr->len; i++) {
+		tr->pkt[i] = malloc(rts->datalen + 28);
+		if (!tr->pkt[i])
+			error(2, errno, _("memory allocation failed"));
+		memcpy(tr->pkt[i], rts->outpack, rts->datalen + 8);
+	}
+}
+
+/*
+ * Build the probes of a train with the per-family builder and hand them
+ * to the kernel in one go.  Returns the number of probes sent, or -1 with
+ * errno set if not even the first one went out.
+ */
+int train_sendmmsg(struct ping_rts *rts, struct socket_st *sock, build_probe_fn build,
+		   void *dest, socklen_t destlen, void *control, size_t controllen)
+{
+	struct train_state *tr = rts->train;
+	struct mmsghdr msgs[TRAIN_MAX_LEN];
+	struct iovec iov[TRAIN_MAX_LEN];
+	long ntransmitted = rts->ntransmitted;
+	int count = tr->len;
+	int i, cc;
+
+	if (rts->npackets && !rts->deadline && rts->npackets - ntransmitted < count)
+		count = rts->npackets - ntransmitted;
+
+	memset(msgs, 0, sizeof(msgs[0]) * count);
+	for (i = 0; i < count; i++) {
+		/* The builders number the probe after rts->ntransmitted. */
+		rts->ntransmitted = ntransmitted + i;
+		cc = build(rts, tr->pkt[i], rts->datalen + 8);
+		iov[i].iov_base = tr->pkt[i];
+		iov[i].iov_len = cc;
+		msgs[i].msg_hdr.msg_name = dest;
+		msgs[i].msg_hdr.msg_namelen = destlen;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		if (controllen) {
+			msgs[i].msg_hdr.msg_control = control;
+			msgs[i].msg_hdr.msg_controllen = controllen;
+		}
+	}
+	rts->ntransmitted = ntransmitted;
+	tr->hdrlen = ((struct sockaddr *)dest)->sa_family == AF_INET6 ? 40 : 20 + rts->optlen;
+
+	cc = sendmmsg(sock->fd, msgs, count, rts->confirm);
+	rts->confirm = 0;
+	if (cc > 0 && cc < count)
+		tr->nshort++;
+	return cc > 0 ? cc : -1;
+}
+
+static double train_median(struct train_state *tr)
+{
+	int n = tr->nestimates < TRAIN_MAX_ESTIMATES ? tr->nestimates : TRAIN_MAX_ESTIMATES;
+	double *v, m;
+	int i, j;
+
+	v = malloc(n * sizeof(*v));
+	if (!v)
+		return 0;
+	memcpy(v, tr->estimates, n * sizeof(*v));
+	/* Insertion sort, this runs once at exit. */
+	for (i = 1; i < n; i++) {
+		double x = v[i];
+
+		for (j = i; j > 0 && v[j - 1] > x; j--)
+			v[j] = v[j - 1];
+		v[j] = x;
+	}
+	m = n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+	free(v);
+	return m;
+}
+
+static void train_close(struct ping_rts *rts, struct train_rec *rec, int report)
+{
+	struct train_state *tr = rts->train;
+	double span, bps = 0;
+
+	if (!rec->id)
+		return;
+	if (rec->nrecv < rec->nsent) {
+		tr->nlost_trains++;
+		tr->nlost += rec->nsent - rec->nrecv;
+	}
+	span = (rec->last_rx.tv_sec - rec->first_rx.tv_sec) +
+	       (rec->last_rx.tv_usec - rec->first_rx.tv_usec) / 1000000.0;
+	/*
+	 * Only the gaps between replies carry information, as many as the
+	 * probes between the first and the last one answered, lost or not.
+	 */
+	if (rec->last_idx > rec->first_idx && span > 0) {
+		bps = (rec->last_idx - rec->first_idx) * (rec->icmplen + rec->hdrlen) * 8 / span;
+		tr->estimates[tr->nestimates++ % TRAIN_MAX_ESTIMATES] = bps;
+	}
+
+	if (report && !rts->opt_quiet && !rts->opt_flood) {
+		/* Printed by train_flush(), after the line of the last reply. */
+		tr->done = *rec;
+		tr->done_span = span;
+		tr->done_bps = bps;
+	}
+	rec->id = 0;
+}
+
+void train_flush(struct ping_rts *rts)
+{
+	struct train_state *tr = rts->train;
+	struct train_rec *rec = &tr->done;
+
+	if (!rec->id)
+		return;
+	printf(_("train %ld: %d/%d replies"), rec->id, rec->nrecv, rec->nsent);
+	if (tr->done_bps > 0)
+		printf(_(", dispersion %.3f ms, %.1f Mbit/s"), tr->done_span * 1000,
+		       tr->done_bps / 1e6);
+	putchar('\n');
+	rec->id = 0;
+}
+
+/* How long the replies of a train are waited for, as at the end of the run. */
+static long train_wait_us(struct ping_rts *rts)
+{
+	long wait;
+
+	if (!rts->nreceived)
+		return rts->lingertime * 1000L;
+	wait = 2 * rts->tmax;
+	if (wait < 1000L * rts->interval)
+		wait = 1000L * rts->interval;
+	return wait;
+}
+
+/* Report the trains still missing replies past the wait, oldest first. */
+static void train_expire(struct ping_rts *rts, const struct timeval *now)
+{
+	struct train_state *tr = rts->train;
+	long wait = train_wait_us(rts);
+	long id;
+
+	for (id = tr->ntrains - TRAIN_RING + 1; id <= tr->ntrains; id++) {
+		struct train_rec *rec = &tr->ring[id % TRAIN_RING];
+		struct timeval age;
+
+		if (id <= 0 || rec->id != id)
+			continue;
+		timersub(now, &rec->sent, &age);
+		if (age.tv_sec * 1000000L + age.tv_usec < wait)
+			break;
+		train_close(rts, rec, 1);
+		train_flush(rts);
+	}
+}
+
+/* Record the train just sent as sequence numbers ntransmitted-nsent+1.. */
+void train_sent(struct ping_rts *rts, int nsent)
+{
+	struct train_state *tr = rts->train;
+	struct train_rec *rec;
+	struct timeval now;
+	long seq;
+
+	gettimeofday(&now, NULL);
+	train_expire(rts, &now);
+	tr->ntrains++;
+	rec = &tr->ring[tr->ntrains % TRAIN_RING];
+	/* Still open with more trains than the ring in flight. */
+	train_close(rts, rec, 1);
+	train_flush(rts);
+
+	memset(rec, 0, sizeof(*rec));
+	rec->id = tr->ntrains;
+	rec->nsent = nsent;
+	rec->hdrlen = tr->hdrlen;
+	rec->icmplen = rts->datalen + 8;
+	rec->first_seq = rts->ntransmitted - nsent + 1;
+	rec->sent = now;
+	for (seq = rts->ntransmitted - nsent + 1; seq <= rts->ntransmitted; seq++)
+		tr->by_seq[seq % MAX_DUP_CHK] = tr->ntrains;
+}
+
+void train_reply(struct ping_rts *rts, uint16_t seq, const struct timeval *rx)
+{
+	struct train_state *tr = rts->train;
+	struct train_rec *rec;
+	uint32_t id = tr->by_seq[seq % MAX_DUP_CHK];
+	int idx;
+
+	rec = &tr->ring[id % TRAIN_RING];
+	if (!id || rec->id != id)
+		return;
+	idx = (uint16_t)(seq - rec->first_seq);
+	if (!rec->nrecv || timercmp(rx, &rec->first_rx, <)) {
+		rec->first_rx = *rx;
+		rec->first_idx = idx;
+	}
+	if (!rec->nrecv || timercmp(rx, &rec->last_rx, >)) {
+		rec->last_rx = *rx;
+		rec->last_idx = idx;
+	}
+	if (++rec->nrecv == rec->nsent)
+		train_close(rts, rec, 1);
+}
+
+void train_print(struct ping_rts *rts)
+{
+	struct train_state *tr = rts->train;
+	long id;
+
+	if (!tr)
+		return;
+	for (id = tr->ntrains - TRAIN_RING + 1; id <= tr->ntrains; id++)
+		if (id > 0)
+			train_close(rts, &tr->ring[id % TRAIN_RING], 0);
+
+	printf(_("trains: %ld sent, %ld with loss (%ld probes lost)"),
+	       tr->ntrains, tr->nlost_trains, tr->nlost);
+	if (tr->nshort)
+		printf(_(", %ld cut short"), tr->nshort);
+	if (tr->nestimates) {
+		int n = tr->nestimates < TRAIN_MAX_ESTIMATES ? tr->nestimates : TRAIN_MAX_ESTIMATES;
+		double min = tr->estimates[0], max = tr->estimates[0];
+		int i;
+
+		for (i = 1; i < n; i++) {
+			if (tr->estimates[i] < min)
+				min = tr->estimates[i];
+			if (tr->estimates[i] > max)
+				max = tr->estimates[i];
+		}
+		printf(_(", capacity min/median/max = %.1f/%.1f/%.1f Mbit/s"),
+		       min / 1e6, train_median(tr) / 1e6, max / 1e6);
+	}
+	putchar('\n');
+}
@@ -0,0 +1,62 @@
+#ifndef IPUTILS_PING_TRAIN_H
+#define IPUTILS_PING_TRAIN_H
+
+#ifndef IPUTILS_PING_H
+#error ping_train.h is not to be included directly, but via ping.h
+#endif
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+struct ping_rts;
+struct socket_st;
+
+#define TRAIN_MAX_LEN		64	/* probes per train */
+#define TRAIN_RING		256	/* trains awaiting replies */
+#define TRAIN_MAX_ESTIMATES	4096	/* kept for the median */
+
+/* One train of back-to-back probes and the arrival times of its replies. */
+struct train_rec {
+	long id;			/* 0 = slot unused */
+	int nsent;
+	int nrecv;
+	int hdrlen;			/* IP header size, for the bits on the wire */
+	size_t icmplen;
+	long first_seq;
+	int first_idx;			/* in the train, of the probe answered first */
+	int last_idx;			/* and of the one answered last */
+	struct timeval sent;
+	struct timeval first_rx;
+	struct timeval last_rx;
+};
+
+struct train_state {
+	int len;			/* -k: probes per train */
+	int hdrlen;
+	long ntrains;
+	long nlost_trains;		/* trains missing at least one reply */
+	long nlost;			/* probes lost in trains */
+	long nshort;			/* trains cut short by sendmmsg() */
+	unsigned char *pkt[TRAIN_MAX_LEN];
+	uint32_t *by_seq;		/* train id, by sequence number */
+	struct train_rec ring[TRAIN_RING];
+	struct train_rec done;		/* closed, not yet reported */
+	double done_span;
+	double done_bps;
+	double *estimates;		/* bit/s, one per usable train */
+	int nestimates;
+};
+
+typedef int (*build_probe_fn)(struct ping_rts *rts, void *packet, unsigned packet_size);
+
+extern struct train_state *parse_train(const char *arg);
+extern void train_prepare(struct ping_rts *rts);
+extern int train_sendmmsg(struct ping_rts *rts, struct socket_st *sock, build_probe_fn build,
+			  void *dest, socklen_t destlen, void *control, size_t controllen);
+extern void train_sent(struct ping_rts *rts, int nsent);
+extern void train_reply(struct ping_rts *rts, uint16_t seq, const struct timeval *rx);
+extern void train_flush(struct ping_rts *rts);
+extern void train_print(struct ping_rts *rts);
+
+#endif /* IPUTILS_PING_TRAIN_H */
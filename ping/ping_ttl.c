@@ -0,0 +1,120 @@
+/*
+ *			P I N G _ T T L . C
+ *
+ * Route change detection from the reply ttl.  The ttl (IPv6 hop limit) of
+ * the replies counts down the hops of the return path, so a shift means
+ * the return path changed, which is worth knowing when the latency shifts
+ * at the same time.  Replies are split into segments of equal ttl, every
+ * change is reported with the rtt before and after it, and finish() lists
+ * the segments and the ttl distribution.
+ *
+ * Status -
+ *	Public Domain.  Distribution Unlimited.
+ */
+
+#include "ping.h"
+
+static struct ttl_segment *ttl_new_segment(struct ttl_track *tt, int ttl, uint16_t seq,
+					   const struct timeval *rx)
+{
+	struct ttl_segment *seg;
+
+	if (tt->nsegs == tt->segs_alloc) {
+		size_t n = tt->segs_alloc ? tt->segs_alloc * 2 : 8;
+
+		seg = realloc(tt->segs, n * sizeof(*seg));
+		if (!seg)
+			error(2, errno, _("memory allocation failed"));
+		tt->segs = seg;
+		tt->segs_alloc = n;
+	}
+	seg = &tt->segs[tt->nsegs++];
+	seg->ttl = ttl;
+	seg->first_seq = seg->last_seq = seq;
+	seg->start = *rx;
+	rtt_stats_init(&seg->rtt);
+	return seg;
+}
+
+static void print_rtt(struct rtt_stats *s)
+{
+	long avg = rtt_stats_avg(s), p50 = rtt_stats_percentile(s, 50);
+
+	printf(_("%ld.%03ld/%ld.%03ld ms avg/median over %ld"), avg / 1000, avg % 1000,
+	       p50 / 1000, p50 % 1000, s->count);
+}
+
+static void ttl_report(struct ping_rts *rts, int idx)
+{
+	struct ttl_segment *after = &rts->reply_ttl.segs[idx], *before = after - 1;
+
+	printf(_("[%ld.%06ld] path change: ttl %d -> %d at icmp_seq=%u, rtt before "),
+	       (long)after->start.tv_sec, (long)after->start.tv_usec,
+	       before->ttl, after->ttl, after->first_seq);
+	print_rtt(&before->rtt);
+	printf(_(", after "));
+	print_rtt(&after->rtt);
+	putchar('\n');
+}
+
+void ttl_reply(struct ping_rts *rts, int ttl, uint16_t seq, const struct timeval *rx,
+	       long triptime)
+{
+	struct ttl_track *tt = &rts->reply_ttl;
+	struct ttl_segment *seg;
+
+	if (ttl < 0 || ttl > 255)
+		return;
+	tt->hist[ttl]++;
+
+	seg = tt->nsegs ? &tt->segs[tt->nsegs - 1] : NULL;
+	if (!seg || seg->ttl != ttl) {
+		/* The previous change did not live long enough, report it now. */
+		if (tt->unreported && !rts->opt_quiet)
+			ttl_report(rts, tt->unreported);
+		seg = ttl_new_segment(tt, ttl, seq, rx);
+		tt->unreported = tt->nsegs > 1 ? (int)tt->nsegs - 1 : 0;
+	}
+	seg->last_seq = seq;
+	if (rts->timing)
+		rtt_stats_add(&seg->rtt, triptime);
+	if (tt->unreported && seg->rtt.count >= TTL_EVENT_REPLIES) {
+		if (!rts->opt_quiet)
+			ttl_report(rts, tt->unreported);
+		tt->unreported = 0;
+	}
+}
+
+void ttl_print(struct ping_rts *rts)
+{
+	struct ttl_track *tt = &rts->reply_ttl;
+	size_t i;
+	int ttl;
+
+	if (tt->nsegs < 2)
+		return;
+	if (tt->unreported && !rts->opt_quiet) {
+		ttl_report(rts, tt->unreported);
+		tt->unreported = 0;
+	}
+	printf(_("reply ttl:"));
+	for (ttl = 0; ttl < 256; ttl++)
+		if (tt->hist[ttl])
+			printf(_(" %d x%u"), ttl, tt->hist[ttl]);
+	printf(_(", %zu changes\n"), tt->nsegs - 1);
+	for (i = 0; i < tt->nsegs; i++) {
+		struct ttl_segment *seg = &tt->segs[i];
+
+		printf(_("  ttl %3d icmp_seq %u-%u since [%ld.%06ld]"), seg->ttl,
+		       seg->first_seq, seg->last_seq,
+		       (long)seg->start.tv_sec, (long)seg->start.tv_usec);
+		if (seg->rtt.count) {
+			long avg = rtt_stats_avg(&seg->rtt);
+
+			printf(_(", rtt min/avg/max = %ld.%03ld/%ld.%03ld/%ld.%03ld ms"),
+			       seg->rtt.min / 1000, seg->rtt.min % 1000, avg / 1000, avg % 1000,
+			       seg->rtt.max / 1000, seg->rtt.max % 1000);
+		}
+		putchar('\n');
+	}
+}
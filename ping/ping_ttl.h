@@ -0,0 +1,44 @@
+#ifndef IPUTILS_PING_TTL_H
+#define IPUTILS_PING_TTL_H
+
+#ifndef IPUTILS_PING_H
+#error ping_ttl.h is not to be included directly, but via ping.h
+#endif
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "iputils_stats.h"
+
+struct ping_rts;
+
+#define TTL_EVENT_REPLIES	5	/* replies on a new ttl before reporting it */
+
+/* A run of replies that all came back with the same ttl. */
+struct ttl_segment {
+	int ttl;
+	uint16_t first_seq;
+	uint16_t last_seq;
+	struct timeval start;		/* receive time of the first reply */
+	struct rtt_stats rtt;
+};
+
+/*
+ * Reply ttl (hop limit) history.  The ttl a reply arrives with only
+ * changes when the return path does, so every change opens a new segment
+ * and is reported as a path change once the new segment has a few rtt
+ * samples to compare against the old one.
+ */
+struct ttl_track {
+	uint32_t hist[256];		/* replies, by ttl */
+	struct ttl_segment *segs;
+	size_t nsegs;
+	size_t segs_alloc;
+	int unreported;			/* segment whose change is not printed yet */
+};
+
+extern void ttl_reply(struct ping_rts *rts, int ttl, uint16_t seq,
+		      const struct timeval *rx, long triptime);
+extern void ttl_print(struct ping_rts *rts);
+
+#endif /* IPUTILS_PING_TTL_H */
@@ -14,14 +14,24 @@
 #include <assert.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <net/if.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
 #include <resolv.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/uio.h>
 #include <time.h>
@@ -34,9 +44,13 @@
 #include <linux/errqueue.h>
 #include <linux/icmp.h>
 #include <linux/icmpv6.h>
+#include <linux/net_tstamp.h>
+#include <linux/rtnetlink.h>
 #include <linux/types.h>
 
 #include "iputils_common.h"
+#include "iputils_lpm.h"
+#include "iputils_stats.h"
 
 #ifdef USE_IDN
 # define getnameinfo_flags	NI_IDN
@@ -53,6 +67,41 @@ enum {
 	HOST_COLUMN_SIZE = 52,
 
 	HIS_ARRAY_SIZE = 64,
+	HIS_ARRAY_LIMIT = 1 << 15,
+
+	HOP_TRIES = 3,
+	HOP_OUTPUT_SIZE = 2048,
+	TIMEOUT_MIN_MS = 10,
+	TIMEOUT_FRONTIER_MS = 100,
+	TIMEOUT_MAX_DEFAULT_MS = 1000,
+
+	WINDOW_DEFAULT = 16,
+	/* Every hop in the window may have all its tries in the ring. */
+	WINDOW_LIMIT = HIS_ARRAY_SIZE / HOP_TRIES,
+
+	HOP_RESPONDERS = 4,
+	REPORT_ROUNDS = 10,
+	INTERVAL_MIN_MS = 100,
+
+	MDA_MAX_FLOWS = 256,
+	MDA_MAX_IFACES = 16,
+	MDA_CONFIDENCE_DEFAULT = 95,
+
+	PL_BASE_IPV4 = 1200,
+	PL_BASE_IPV6 = 1280,
+
+	NAME_THREADS = 4,
+	NAME_BUDGET_MS = 2000,
+	NAME_BUCKETS = 256,
+	NAME_MARK = '\001',
+
+	DT_FIRST_TTL_DEFAULT = 8,
+	STOP_BUCKETS = 65536,
+
+	CACHE_SLOTS = 4096,
+	CACHE_PROBE = 16,
+	CACHE_HOPS = 64,
+	CACHE_SAMPLES = 4,
 
 	DEFAULT_OVERHEAD_IPV4 = 28,
 	DEFAULT_OVERHEAD_IPV6 = 48,
@@ -68,6 +117,197 @@ enum {
 struct hhistory {
 	int hops;
 	struct timespec sendtime;
+	int mtu;
+	uint16_t port;
+	uint32_t tskey;			/* SO_TIMESTAMPING id of the probe */
+	struct timespec txstamp;	/* kernel send time, zero if not known */
+};
+
+struct responder {
+	struct sockaddr_storage addr;
+	socklen_t len;
+	long count;
+	int name;			/* in the name cache */
+};
+
+/* Progress and pending output of one hop. */
+struct hop {
+	int tries;
+	struct timespec sendtime;	/* of the last probe sent */
+	long srtt;			/* usec, 0 before the first reply */
+	long rttvar;
+	size_t len;
+	char out[HOP_OUTPUT_SIZE];	/* NAME_MARK <entry> NAME_MARK for a host */
+	struct timespec names_by;	/* printed with or without names */
+	struct sockaddr_storage from;	/* router that answered, family 0 if none */
+	unsigned int
+		done:1,
+		final:1,		/* the path ends here */
+		resend:1;
+
+	/* Continuous mode, tries counts the probes sent. */
+	long lost;
+	long last_rtt;			/* usec, -1 before the first reply */
+	long jitter_sum;		/* of rtt differences between replies */
+	int ee_errno;			/* error that ended the path here */
+	struct rtt_stats rtt;
+	struct responder resp[HOP_RESPONDERS];
+	int nresp;
+};
+
+/* An error queue message, matched to the hop of its probe. */
+struct hop_reply {
+	int ttl;
+	struct sock_extended_err const *e;
+	struct sockaddr const *offender;
+	long rtt;			/* usec, -1 if unknown */
+	int rethops;
+	int broken_router;
+	int flow;			/* multipath mode, -1 if unknown */
+	int size;			/* of the probe, 0 if unknown */
+};
+
+/* Multipath mode state of a flow at the hop being enumerated. */
+enum {
+	MDA_UNSENT = -3,
+	MDA_INFLIGHT = -2,
+	MDA_SILENT = -1
+	/* or the index of the interface that answered */
+};
+
+struct mda_iface {
+	struct sockaddr_storage addr;
+	socklen_t len;
+	int flows;			/* that went through it */
+	long rtt_min;			/* usec */
+	uint32_t pred;			/* interfaces of the hop before that lead here */
+	int ee_errno;			/* if the path ends here */
+};
+
+/* The interfaces found at one hop, and which flow took which. */
+struct mda_hop {
+	int ttl;
+	struct mda_iface iface[MDA_MAX_IFACES];
+	int niface;
+	int16_t state[MDA_MAX_FLOWS];
+	int nsent;
+	int inflight;
+	int answered;
+	int silent;
+	int overflow;			/* answers from interfaces beyond the table */
+	int pmtu;			/* reported while probing this hop */
+	int final;
+};
+
+/* Outcome of a packet layer pmtu probe. */
+enum {
+	PL_PENDING,
+	PL_OK,
+	PL_TOO_BIG,
+	PL_FAILED			/* the path ended before the destination */
+};
+
+/* What a hop answered during the black hole scan. */
+struct pl_hop {
+	int ok[2];			/* to the small and the big probe */
+	int reached;
+	struct sockaddr_storage addr;
+};
+
+/* Packet layer pmtu discovery. */
+struct pl_state {
+	int size;			/* of the probe in flight */
+	int outcome;
+	int reported;			/* pmtu in a too big report */
+	struct sockaddr_storage from;	/* of the report */
+	long rtt;
+	int ee_errno;
+	int scan_small;
+	int scan_big;
+	struct pl_hop *scan;		/* by ttl, during the black hole scan */
+};
+
+/* A hop address, and its name once the lookup is done. */
+struct host_name {
+	int family;
+	uint8_t key[16];		/* the address, IPv4 in the first four bytes */
+	struct sockaddr_storage addr;
+	socklen_t len;
+	char *numeric;
+	char *name;			/* NULL while the lookup is running */
+	int next;			/* in the hash chain, plus one */
+};
+
+/*
+ * Reverse lookups of hop addresses, shared by all hops and rounds.  The
+ * entries from next_job on wait for one of the resolver threads, which
+ * wake the main loop through the pipe when they are done.  The lock
+ * covers the names and the job counter; only the main loop adds entries.
+ */
+struct name_cache {
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	struct host_name *ent;
+	int nent;
+	int alloc;
+	int next_job;
+	int idle;			/* threads waiting for work */
+	int nthreads;
+	int bucket[NAME_BUCKETS];	/* plus one, 0 if empty */
+	int pipe[2];
+	int lookups;			/* names are wanted, not only numbers */
+};
+
+/* A hop address seen at a ttl, on the path to some destination. */
+struct stop_entry {
+	int family;
+	uint8_t key[16];
+	int ttl;
+	int next;			/* in the bucket chain, index + 1 */
+};
+
+/*
+ * Multi-destination mode.  Every path is probed forward from first_ttl to
+ * the destination and then backward, until it reaches a hop address that
+ * an earlier path had at the same ttl; the hops before are taken as known.
+ */
+struct doubletree {
+	char **dests;
+	int ndests;
+	int first_ttl;
+	int mtu;			/* to start every path with */
+	struct stop_entry *stop;	/* the global stop set */
+	int nstop;
+	int stop_alloc;
+	int *bucket;			/* STOP_BUCKETS chains, index + 1 */
+	long probes;			/* sent, over all destinations */
+	long skipped;			/* hops not probed thanks to the stop set */
+};
+
+/* The last path traced to a destination, in the path cache file. */
+struct path_entry {
+	int64_t updated;		/* time() of the trace, 0 for a free slot */
+	uint8_t family;			/* of the destination */
+	uint8_t hop_family;		/* of the hops */
+	uint8_t nhops;			/* the destination answered at this ttl */
+	uint8_t pad[5];
+	uint8_t dst[16];
+	uint8_t hop[CACHE_HOPS][16];	/* by ttl - 1, zero for a silent hop */
+};
+
+#define PATH_CACHE_MAGIC	"tracepath cache\n"
+
+/*
+ * The path cache file, mapped shared so that audits running at the same
+ * time see each other's updates.  Entries are found by open addressing
+ * over CACHE_PROBE slots; a full run of slots loses its oldest entry.
+ */
+struct path_cache {
+	char magic[16];
+	uint32_t slots;
+	uint32_t hops;
+	uint8_t pad[40];
+	struct path_entry entry[];
 };
 
 struct probehdr {
@@ -76,322 +316,2365 @@ struct probehdr {
 };
 
 struct run_state {
-	struct hhistory his[HIS_ARRAY_SIZE];
+	struct hhistory *his;
+	int his_size;			/* a power of two, HIS_ARRAY_SIZE at least */
 	int hisptr;
 	struct sockaddr_storage target;
 	struct addrinfo *ai;
 	int socket_fd;
 	socklen_t targetlen;
 	uint16_t base_port;
-	uint8_t ttl;
 	int max_hops;
+	struct hop *hop;		/* indexed by ttl */
+	int window;			/* hops probed at once */
+	int next_ttl;			/* next hop to open */
+	int print_ttl;			/* first hop not printed yet */
+	int last_ttl;			/* last hop of interest */
+	int sending_ttl;		/* hop of the probe being sent */
 	int overhead;
 	int mtu;
 	void *pktbuf;
 	int hops_to;
 	int hops_from;
+	long interval_ms;		/* between rounds in continuous mode */
+	long max_timeout_ms;		/* cap of the adaptive probe timeout */
+	long rounds;			/* continuous mode rounds, 0 is forever */
+	int flow;			/* of the next probe in multipath mode */
+	struct mda_hop *mda;		/* hop being enumerated */
+	struct mda_hop *mda_prev;	/* the hop before it */
+	struct pl_state pl;
+	struct name_cache names;
+	struct doubletree dt;
+	struct lpm_table *prefixes;	/* hop labels by prefix (-G) */
+	struct path_cache *cache;	/* -R */
+	int cache_fd;
+	int mda_needed[MDA_MAX_IFACES + 1];	/* answers to rule out one more interface */
+	int confidence;			/* percent, multipath mode */
+	uint32_t tskey;			/* id of the next probe sent */
+	long kernel_rtts;		/* hop rtts from kernel timestamps */
+	long user_rtts;			/* and from clock_gettime() */
 	unsigned int
 		no_resolve:1,
 		show_both:1,
-		mapped:1;
+		mapped:1,
+		continuous:1,
+		flow_stable:1,		/* same 5-tuple for all probes */
+		multipath:1,
+		plpmtud:1,
+		doubletree:1;
 };
 
+static volatile sig_atomic_t exiting;
+
+/*
+ * All includes, definitions, struct declarations, and global variables are
+ * above.  After this comment all you can find is functions.
+ */
+
+static void timespec_add_ms(struct timespec *ts, long ms)
+{
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (ms % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_nsec -= 1000000000;
+		ts->tv_sec++;
+	}
+}
+
+static long timespec_diff_ms(struct timespec const *const a, struct timespec const *const b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000 + (a->tv_nsec - b->tv_nsec) / 1000000;
+}
+
+/* RFC 6298 smoothed rtt and rtt variation, per hop. */
+static void hop_rtt_sample(struct hop *hop, long rtt)
+{
+	if (!hop->srtt) {
+		hop->srtt = rtt ? rtt : 1;
+		hop->rttvar = rtt / 2;
+		return;
+	}
+	hop->rttvar += (labs(hop->srtt - rtt) - hop->rttvar) / 4;
+	hop->srtt += (rtt - hop->srtt) / 8;
+	if (!hop->srtt)
+		hop->srtt = 1;
+}
+
+/*
+ * How long to wait for the answer to a probe to this hop, doubled for
+ * every earlier try.  Taken from the rtt estimate (srtt + 4 rttvar) of
+ * this hop or, as long as it has none, of the nearest hop beyond it that
+ * answered: a silent hop in the middle of the path is given up on quickly.
+ * Past the last hop that answered, twice the estimate of the nearest hop
+ * before, but at least TIMEOUT_FRONTIER_MS, leaves room for a slow link.
+ * Without any estimate yet, wait as long as allowed.
+ */
+static long hop_timeout_ms(struct run_state const *const ctl, int ttl, int backoff)
+{
+	long usec = 0;
+	long ms;
+	long min_ms = TIMEOUT_MIN_MS;
+	int h;
+
+	for (h = ttl; h <= ctl->last_ttl && h <= ctl->max_hops; h++)
+		if (ctl->hop[h].srtt) {
+			usec = ctl->hop[h].srtt + 4 * ctl->hop[h].rttvar;
+			break;
+		}
+	if (!usec) {
+		for (h = ttl - 1; h > 0 && !ctl->hop[h].srtt; h--)
+			;
+		if (!h)
+			return ctl->max_timeout_ms;
+		usec = 2 * (ctl->hop[h].srtt + 4 * ctl->hop[h].rttvar);
+		min_ms = TIMEOUT_FRONTIER_MS;
+	}
+	ms = (usec + 999) / 1000;
+	if (ms < min_ms)
+		ms = min_ms;
+	while (backoff-- > 0 && ms < ctl->max_timeout_ms)
+		ms *= 2;
+	if (ms > ctl->max_timeout_ms)
+		ms = ctl->max_timeout_ms;
+	return ms;
+}
+
+/* Append to the output of a hop, which is printed once the hop is done. */
+static int hop_printf(struct run_state *const ctl, int ttl, char const *const fmt, ...)
+{
+	struct hop *hop = &ctl->hop[ttl];
+	size_t room = sizeof(hop->out) - hop->len;
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(hop->out + hop->len, room, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return 0;
+	if ((size_t)n >= room)
+		n = room - 1;
+	hop->len += n;
+	return n;
+}
+
+static void hop_done(struct run_state *const ctl, int ttl, int final)
+{
+	ctl->hop[ttl].done = 1;
+	/* Give the name lookups of the hop a while to finish. */
+	clock_gettime(CLOCK_MONOTONIC, &ctl->hop[ttl].names_by);
+	timespec_add_ms(&ctl->hop[ttl].names_by, NAME_BUDGET_MS);
+	if (final) {
+		ctl->hop[ttl].final = 1;
+		/* Nothing beyond this hop is worth waiting for. */
+		if (ttl < ctl->last_ttl)
+			ctl->last_ttl = ttl;
+	}
+}
+
+static int is_ttl_exceeded(struct sock_extended_err const *const e)
+{
+	return (e->ee_origin == SO_EE_ORIGIN_ICMP &&
+		e->ee_type == ICMP_TIME_EXCEEDED &&
+		e->ee_code == ICMP_EXC_TTL) ||
+	       (e->ee_origin == SO_EE_ORIGIN_ICMP6 &&
+		e->ee_type == ICMPV6_TIME_EXCEED &&
+		e->ee_code == ICMPV6_EXC_HOPLIMIT);
+}
+
+static socklen_t sockaddr_len(struct sockaddr const *const sa)
+{
+	switch (sa->sa_family) {
+	case AF_INET6:
+		return sizeof(struct sockaddr_in6);
+	case AF_INET:
+		return sizeof(struct sockaddr_in);
+	}
+	return 0;
+}
+
+/* Resolver thread: look up the names of new entries, one at a time. */
+static void *name_resolver(void *arg)
+{
+	struct name_cache *nc = arg;
+
+	pthread_mutex_lock(&nc->lock);
+	while (1) {
+		struct sockaddr_storage addr;
+		socklen_t len;
+		char host[NI_MAXHOST];
+		char *name;
+		int i;
+
+		while (nc->next_job == nc->nent) {
+			nc->idle++;
+			pthread_cond_wait(&nc->work, &nc->lock);
+			nc->idle--;
+		}
+		i = nc->next_job++;
+		memcpy(&addr, &nc->ent[i].addr, sizeof(addr));
+		len = nc->ent[i].len;
+		pthread_mutex_unlock(&nc->lock);
+
+		if (getnameinfo((struct sockaddr *)&addr, len, host, sizeof(host), NULL, 0,
+				getnameinfo_flags))
+			strcpy(host, "???");
+		name = strdup(host);
+
+		pthread_mutex_lock(&nc->lock);
+		nc->ent[i].name = name ? name : nc->ent[i].numeric;
+		if (write(nc->pipe[1], "", 1) < 0) {
+			/* Full, the main loop has a wakeup pending already. */
+		}
+	}
+	return NULL;
+}
+
+static void names_init(struct run_state *const ctl)
+{
+	struct name_cache *nc = &ctl->names;
+
+	pthread_mutex_init(&nc->lock, NULL);
+	pthread_cond_init(&nc->work, NULL);
+	nc->pipe[0] = nc->pipe[1] = -1;
+	nc->lookups = !ctl->no_resolve || ctl->show_both;
+	if (nc->lookups && pipe2(nc->pipe, O_CLOEXEC | O_NONBLOCK))
+		error(1, errno, "pipe2");
+}
+
+static void names_drain(struct run_state *const ctl)
+{
+	char buf[64];
+
+	if (ctl->names.pipe[0] >= 0)
+		while (read(ctl->names.pipe[0], buf, sizeof(buf)) > 0)
+			;
+}
+
+static void addr_key(struct sockaddr const *const sa, uint8_t *key)
+{
+	memset(key, 0, 16);
+	if (sa->sa_family == AF_INET6)
+		memcpy(key, &((struct sockaddr_in6 const *)sa)->sin6_addr, 16);
+	else
+		memcpy(key, &((struct sockaddr_in const *)sa)->sin_addr, 4);
+}
+
+static uint32_t key_hash(uint8_t const *key, int extra)
+{
+	uint32_t h = 2166136261u;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		h = (h ^ key[i]) * 16777619u;
+	h = (h ^ extra) * 16777619u;
+	return h ^ (h >> 15);
+}
+
+/*
+ * The name cache entry of an address, started on its lookup when it is
+ * new.  Threads are added up to NAME_THREADS while none is idle, so that
+ * a slow reverse zone holds up only the lookups that go there.
+ */
+static int name_lookup(struct run_state *const ctl, struct sockaddr const *const sa)
+{
+	struct name_cache *nc = &ctl->names;
+	struct host_name *hn;
+	char numeric[NI_MAXHOST];
+	uint8_t key[16];
+	uint32_t h;
+	int i;
+
+	addr_key(sa, key);
+	h = key_hash(key, 0) % NAME_BUCKETS;
+
+	pthread_mutex_lock(&nc->lock);
+	for (i = nc->bucket[h]; i; i = nc->ent[i - 1].next) {
+		hn = &nc->ent[i - 1];
+		if (hn->family == sa->sa_family && !memcmp(hn->key, key, sizeof(key))) {
+			pthread_mutex_unlock(&nc->lock);
+			return i - 1;
+		}
+	}
+	if (nc->nent == nc->alloc) {
+		int n = nc->alloc ? nc->alloc * 2 : 64;
+
+		hn = realloc(nc->ent, n * sizeof(*hn));
+		if (!hn)
+			error(1, errno, "realloc");
+		nc->ent = hn;
+		nc->alloc = n;
+	}
+	hn = &nc->ent[nc->nent];
+	memset(hn, 0, sizeof(*hn));
+	hn->family = sa->sa_family;
+	memcpy(hn->key, key, sizeof(key));
+	hn->len = sockaddr_len(sa);
+	memcpy(&hn->addr, sa, hn->len);
+	if (getnameinfo(sa, hn->len, numeric, sizeof(numeric), NULL, 0, NI_NUMERICHOST))
+		strcpy(numeric, "???");
+	hn->numeric = strdup(numeric);
+	if (!hn->numeric)
+		error(1, errno, "strdup");
+	hn->next = nc->bucket[h];
+	nc->bucket[h] = ++nc->nent;
+
+	if (!nc->lookups) {
+		hn->name = hn->numeric;
+		nc->next_job = nc->nent;
+	} else if (!nc->idle && nc->nthreads < NAME_THREADS) {
+		sigset_t all;
+		sigset_t old;
+		pthread_t tid;
+
+		/* Signals are for the main loop. */
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+		if (pthread_create(&tid, NULL, name_resolver, nc))
+			error(1, errno, "pthread_create");
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+		pthread_detach(tid);
+		nc->nthreads++;
+	} else
+		pthread_cond_signal(&nc->work);
+	pthread_mutex_unlock(&nc->lock);
+	return nc->nent - 1;
+}
+
+static int name_done(struct run_state *const ctl, int idx)
+{
+	int done;
+
+	pthread_mutex_lock(&ctl->names.lock);
+	done = ctl->names.ent[idx].name != NULL;
+	pthread_mutex_unlock(&ctl->names.lock);
+	return done;
+}
+
+/* Wait for a lookup until the deadline.  Returns 1 if it is done. */
+static int name_wait(struct run_state *const ctl, int idx, struct timespec const *const deadline)
+{
+	struct pollfd pfd = {
+		.fd = ctl->names.pipe[0],
+		.events = POLLIN
+	};
+
+	while (!name_done(ctl, idx)) {
+		struct timespec now;
+		long ms;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = timespec_diff_ms(deadline, &now);
+		if (ms <= 0)
+			return 0;
+		poll(&pfd, 1, ms);
+		names_drain(ctl);
+	}
+	return 1;
+}
+
+/*
+ * The host column text of an entry, as -n and -b want it.  The number
+ * stands in for a name that is not known yet.
+ */
+static int name_format(struct run_state *const ctl, int idx, char *buf, size_t size)
+{
+	struct host_name *hn = &ctl->names.ent[idx];
+	char const *name;
+	int n;
+
+	pthread_mutex_lock(&ctl->names.lock);
+	name = hn->name ? hn->name : hn->numeric;
+	if (!ctl->show_both)
+		n = snprintf(buf, size, "%s", ctl->no_resolve ? hn->numeric : name);
+	else if (ctl->no_resolve)
+		n = snprintf(buf, size, "%s (%s)", hn->numeric, name);
+	else
+		n = snprintf(buf, size, "%s (%s)", name, hn->numeric);
+	pthread_mutex_unlock(&ctl->names.lock);
+	if (n >= (int)size)
+		n = size - 1;
+	if (ctl->prefixes) {
+		char label[128];
+		void const *addr = &((struct sockaddr_in const *)&hn->addr)->sin_addr;
+
+		if (hn->family == AF_INET6)
+			addr = &((struct sockaddr_in6 const *)&hn->addr)->sin6_addr;
+		if (lpm_label(ctl->prefixes, hn->family, addr, label, sizeof(label)))
+			n += snprintf(buf + n, size - n, " [%s]", label);
+		if (n >= (int)size)
+			n = size - 1;
+	}
+	return n;
+}
+
+/* Print the names of a hop, waiting for them a while.  Returns their length. */
+static int print_names(struct run_state *const ctl, struct sockaddr const *const sa)
+{
+	char buf[2 * NI_MAXHOST + 4];
+	struct timespec deadline;
+	int idx = name_lookup(ctl, sa);
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	timespec_add_ms(&deadline, NAME_BUDGET_MS);
+	name_wait(ctl, idx, &deadline);
+	name_format(ctl, idx, buf, sizeof(buf));
+	return printf("%s", buf);
+}
+
+/* The host column of a hop, filled in when the hop is printed. */
+static void hop_host(struct run_state *const ctl, int ttl, struct sockaddr const *const sa)
+{
+	hop_printf(ctl, ttl, "%c%d%c", NAME_MARK, name_lookup(ctl, sa), NAME_MARK);
+}
+
+/* Whether the names of a hop are known, or not worth waiting for anymore. */
+static int hop_names_ready(struct run_state *const ctl, struct hop const *const hop,
+			   struct timespec const *const now)
+{
+	char const *p = hop->out;
+	char const *end = hop->out + hop->len;
+
+	if (timespec_diff_ms(&hop->names_by, now) <= 0)
+		return 1;
+	while ((p = memchr(p, NAME_MARK, end - p))) {
+		if (!name_done(ctl, atoi(p + 1)))
+			return 0;
+		p = (char const *)memchr(p + 1, NAME_MARK, end - p - 1) + 1;
+	}
+	return 1;
+}
+
+/* Print the output of a hop, with the host columns filled in. */
+static void hop_write(struct run_state *const ctl, struct hop const *const hop)
+{
+	char const *p = hop->out;
+	char const *end = hop->out + hop->len;
+	char const *mark;
+
+	while ((mark = memchr(p, NAME_MARK, end - p))) {
+		char buf[2 * NI_MAXHOST + 4];
+		int plen;
+
+		fwrite(p, 1, mark - p, stdout);
+		plen = name_format(ctl, atoi(mark + 1), buf, sizeof(buf));
+		if (plen >= HOST_COLUMN_SIZE)
+			plen = HOST_COLUMN_SIZE - 1;
+		printf("%s%*s", buf, HOST_COLUMN_SIZE - plen, "");
+		p = (char const *)memchr(mark + 1, NAME_MARK, end - mark - 1) + 1;
+	}
+	fwrite(p, 1, end - p, stdout);
+}
+
+/* Format a reply into the output of its hop, the classic tracepath way. */
+static void print_reply(struct run_state *const ctl, struct hop_reply const *const r)
+{
+	struct sock_extended_err const *const e = r->e;
+	int ttl = r->ttl;
+
+	if (e->ee_origin == SO_EE_ORIGIN_LOCAL)
+		hop_printf(ctl, ttl, "%2d?: %-32s ", ttl, _("[LOCALHOST]"));
+	else if (e->ee_origin == SO_EE_ORIGIN_ICMP6 ||
+		 e->ee_origin == SO_EE_ORIGIN_ICMP) {
+		hop_printf(ctl, ttl, "%2d:  ", ttl);
+		hop_host(ctl, ttl, r->offender);
+		/* A pmtu report may come from a hop before. */
+		if (e->ee_errno != EMSGSIZE)
+			memcpy(&ctl->hop[ttl].from, r->offender, sockaddr_len(r->offender));
+	}
+
+	if (r->rtt >= 0) {
+		hop_printf(ctl, ttl, _("%3ld.%03ldms "), r->rtt / 1000, r->rtt % 1000);
+		if (r->broken_router)
+			hop_printf(ctl, ttl, _("(This broken router returned corrupted payload) "));
+	}
+
+	switch (e->ee_errno) {
+	case ETIMEDOUT:
+		hop_printf(ctl, ttl, "\n");
+		hop_done(ctl, ttl, 0);
+		break;
+	case EMSGSIZE:
+		hop_printf(ctl, ttl, _("pmtu %d\n"), e->ee_info);
+		ctl->mtu = e->ee_info;
+		/* Probe this hop again, with the full number of tries. */
+		ctl->hop[ttl].resend = 1;
+		ctl->hop[ttl].tries = 0;
+		break;
+	case ECONNREFUSED:
+		hop_printf(ctl, ttl, _("reached\n"));
+		ctl->hops_to = ttl;
+		ctl->hops_from = r->rethops;
+		hop_done(ctl, ttl, 1);
+		break;
+	case EPROTO:
+		hop_printf(ctl, ttl, "!P\n");
+		hop_done(ctl, ttl, 1);
+		break;
+	case EHOSTUNREACH:
+		if (is_ttl_exceeded(e)) {
+			if (r->rethops >= 0 && r->rethops != ttl)
+				hop_printf(ctl, ttl, _("asymm %2d "), r->rethops);
+			hop_printf(ctl, ttl, "\n");
+			hop_done(ctl, ttl, 0);
+			break;
+		}
+		hop_printf(ctl, ttl, "!H\n");
+		hop_done(ctl, ttl, 1);
+		break;
+	case ENETUNREACH:
+		hop_printf(ctl, ttl, "!N\n");
+		hop_done(ctl, ttl, 1);
+		break;
+	case EACCES:
+		hop_printf(ctl, ttl, "!A\n");
+		hop_done(ctl, ttl, 1);
+		break;
+	default:
+		hop_printf(ctl, ttl, "\n");
+		error(0, e->ee_errno, _("NET ERROR"));
+		hop_done(ctl, ttl, 1);
+		break;
+	}
+}
+
+static void hop_reset_stats(struct hop *hop)
+{
+	hop->nresp = 0;
+	hop->tries = 0;
+	hop->lost = 0;
+	hop->last_rtt = -1;
+	hop->jitter_sum = 0;
+	hop->ee_errno = 0;
+	rtt_stats_init(&hop->rtt);
+}
+
+/* Count a reply from sa at this hop, remembering who it came from. */
+static void hop_add_responder(struct run_state *const ctl, struct hop *hop,
+			      struct sockaddr const *const sa)
+{
+	socklen_t salen = sockaddr_len(sa);
+	struct responder *rp;
+	int i;
+
+	for (i = 0; i < hop->nresp; i++) {
+		rp = &hop->resp[i];
+		if (rp->len == salen && !memcmp(&rp->addr, sa, salen)) {
+			rp->count++;
+			return;
+		}
+	}
+	if (hop->nresp == HOP_RESPONDERS) {
+		/* Make room by forgetting the least seen one. */
+		for (i = 1, rp = &hop->resp[0]; i < hop->nresp; i++)
+			if (hop->resp[i].count < rp->count)
+				rp = &hop->resp[i];
+	} else
+		rp = &hop->resp[hop->nresp++];
+
+	memset(rp, 0, sizeof(*rp));
+	memcpy(&rp->addr, sa, salen);
+	rp->len = salen;
+	rp->count = 1;
+	rp->name = name_lookup(ctl, sa);
+}
+
+/*
+ * Account a reply in continuous mode.  The path length follows the
+ * replies: it shrinks to the first hop that ends the path, and grows when
+ * the last hop turns out to be just a router on the way.
+ */
+static void account_reply(struct run_state *const ctl, struct hop_reply const *const r)
+{
+	struct sock_extended_err const *const e = r->e;
+	struct hop *hop = &ctl->hop[r->ttl];
+
+	if (e->ee_errno == EMSGSIZE) {
+		/* Too big for the path, the probe never got to its hop. */
+		ctl->mtu = e->ee_info;
+		if (e->ee_origin != SO_EE_ORIGIN_LOCAL)
+			hop->tries--;
+		return;
+	}
+	if (e->ee_origin == SO_EE_ORIGIN_ICMP6 || e->ee_origin == SO_EE_ORIGIN_ICMP)
+		hop_add_responder(ctl, hop, r->offender);
+	if (r->rtt >= 0) {
+		if (hop->last_rtt >= 0)
+			hop->jitter_sum += labs(r->rtt - hop->last_rtt);
+		hop->last_rtt = r->rtt;
+		rtt_stats_add(&hop->rtt, r->rtt);
+	}
+
+	switch (e->ee_errno) {
+	case ETIMEDOUT:
+	case EMSGSIZE:
+		hop->ee_errno = 0;
+		break;
+	case EHOSTUNREACH:
+		if (is_ttl_exceeded(e)) {
+			hop->ee_errno = 0;
+			if (r->ttl == ctl->last_ttl && ctl->last_ttl < ctl->max_hops)
+				hop_reset_stats(&ctl->hop[++ctl->last_ttl]);
+			break;
+		}
+		/*FALLTHROUGH*/
+	default:
+		hop->ee_errno = e->ee_errno;
+		if (e->ee_errno == ECONNREFUSED) {
+			ctl->hops_to = r->ttl;
+			ctl->hops_from = r->rethops;
+		}
+		if (r->ttl < ctl->last_ttl)
+			ctl->last_ttl = r->ttl;
+	}
+}
+
+/*
+ * Account a reply in multipath mode to the interface it came from.  The
+ * interface the same flow went through at the hop before is linked to it.
+ */
+static void mda_reply(struct run_state *const ctl, struct hop_reply const *const r)
+{
+	struct sock_extended_err const *const e = r->e;
+	struct mda_hop *mh = ctl->mda;
+	struct mda_hop const *prev = ctl->mda_prev;
+	struct mda_iface *ifc;
+	socklen_t salen;
+	int i;
+
+	/* probe_ttl() sends again after a local pmtu report. */
+	if (e->ee_errno == EMSGSIZE && e->ee_origin == SO_EE_ORIGIN_LOCAL) {
+		ctl->mtu = e->ee_info;
+		return;
+	}
+	if (!mh || r->ttl != mh->ttl || r->flow < 0 || r->flow >= MDA_MAX_FLOWS ||
+	    mh->state[r->flow] != MDA_INFLIGHT)
+		return;
+	if (e->ee_errno == EMSGSIZE) {
+		ctl->mtu = mh->pmtu = e->ee_info;
+		mh->state[r->flow] = MDA_UNSENT;
+		mh->nsent--;
+		mh->inflight--;
+		return;
+	}
+	mh->inflight--;
+	if (e->ee_origin != SO_EE_ORIGIN_ICMP && e->ee_origin != SO_EE_ORIGIN_ICMP6) {
+		mh->state[r->flow] = MDA_SILENT;
+		mh->silent++;
+		return;
+	}
+	mh->answered++;
+
+	salen = sockaddr_len(r->offender);
+	for (i = 0; i < mh->niface; i++)
+		if (mh->iface[i].len == salen && !memcmp(&mh->iface[i].addr, r->offender, salen))
+			break;
+	if (i == MDA_MAX_IFACES) {
+		/* No link can be drawn to it, the flow counts as silent. */
+		mh->state[r->flow] = MDA_SILENT;
+		mh->overflow++;
+		return;
+	}
+	ifc = &mh->iface[i];
+	if (i == mh->niface) {
+		memset(ifc, 0, sizeof(*ifc));
+		memcpy(&ifc->addr, r->offender, salen);
+		ifc->len = salen;
+		ifc->rtt_min = -1;
+		mh->niface++;
+	}
+	mh->state[r->flow] = i;
+	ifc->flows++;
+	if (r->rtt >= 0 && (ifc->rtt_min < 0 || r->rtt < ifc->rtt_min))
+		ifc->rtt_min = r->rtt;
+	if (prev && prev->state[r->flow] >= 0)
+		ifc->pred |= 1U << prev->state[r->flow];
+
+	if (e->ee_errno != ETIMEDOUT && !is_ttl_exceeded(e)) {
+		ifc->ee_errno = e->ee_errno;
+		mh->final = 1;
+		if (e->ee_errno == ECONNREFUSED) {
+			ctl->hops_to = r->ttl;
+			ctl->hops_from = r->rethops;
+		}
+	}
+}
+
+/* Account a reply to a pmtu probe, or to one of the black hole scan. */
+static void pl_reply(struct run_state *const ctl, struct hop_reply const *const r)
+{
+	struct sock_extended_err const *const e = r->e;
+	struct pl_state *pl = &ctl->pl;
+
+	/* The interface mtu, probe_ttl() sends again with it. */
+	if (e->ee_errno == EMSGSIZE && e->ee_origin == SO_EE_ORIGIN_LOCAL) {
+		ctl->mtu = e->ee_info;
+		return;
+	}
+	if (e->ee_origin != SO_EE_ORIGIN_ICMP && e->ee_origin != SO_EE_ORIGIN_ICMP6)
+		return;
+
+	if (pl->scan) {
+		struct pl_hop *ph = &pl->scan[r->ttl];
+
+		if (e->ee_errno == EMSGSIZE || (r->size != pl->scan_small && r->size != pl->scan_big))
+			return;
+		ph->ok[r->size == pl->scan_big] = 1;
+		memcpy(&ph->addr, r->offender, sockaddr_len(r->offender));
+		if (e->ee_errno == ECONNREFUSED)
+			ph->reached = 1;
+		return;
+	}
+
+	if (r->size != pl->size || pl->outcome != PL_PENDING)
+		return;
+	pl->rtt = r->rtt;
+	memcpy(&pl->from, r->offender, sockaddr_len(r->offender));
+	switch (e->ee_errno) {
+	case EMSGSIZE:
+		pl->outcome = PL_TOO_BIG;
+		pl->reported = e->ee_info;
+		break;
+	case ECONNREFUSED:
+		pl->outcome = PL_OK;
+		ctl->hops_from = r->rethops;
+		break;
+	default:
+		pl->outcome = PL_FAILED;
+		/* 0 for a path longer than max_hops */
+		pl->ee_errno = is_ttl_exceeded(e) ? 0 : e->ee_errno;
+	}
+}
+
+/*
+ * The history slot of the probe an error is about, -1 if none in flight.
+ * Most routers quote our payload, which tells exactly.  Without it only
+ * the destination port is left: the slot in classic mode, the flow in
+ * multipath mode, and no hint at all in flow-stable mode, where a reply
+ * can only be matched while it is the only probe in flight.
+ */
+static int find_slot(struct run_state *const ctl, struct sockaddr_storage const *const addr,
+		     struct probehdr const *const ph, ssize_t len)
+{
+	uint16_t port = 0;
+	int found = -1;
+	int i;
+
+	if (len == sizeof(*ph) && ph->ttl && (ph->ts.tv_sec || ph->ts.tv_nsec)) {
+		for (i = 0; i < ctl->his_size; i++)
+			if (ctl->his[i].hops && ctl->his[i].hops == (int)ph->ttl &&
+			    ctl->his[i].sendtime.tv_sec == ph->ts.tv_sec &&
+			    ctl->his[i].sendtime.tv_nsec == ph->ts.tv_nsec)
+				return i;
+		return -1;
+	}
+
+	switch (ctl->ai->ai_family) {
+	case AF_INET6:
+		port = ntohs(((struct sockaddr_in6 const *)addr)->sin6_port);
+		break;
+	case AF_INET:
+		port = ntohs(((struct sockaddr_in const *)addr)->sin_port);
+		break;
+	}
+	if (!ctl->flow_stable && !ctl->multipath) {
+		i = (uint16_t)(port - ctl->base_port);
+		return i < ctl->his_size && ctl->his[i].hops ? i : -1;
+	}
+	/* Open one hop at a time from now on, to keep that case common. */
+	if (ctl->flow_stable && port)
+		ctl->window = 1;
+	for (i = 0; i < ctl->his_size; i++) {
+		if (!ctl->his[i].hops || ctl->his[i].port != port)
+			continue;
+		if (found >= 0)
+			return -1;
+		found = i;
+	}
+	return found;
+}
+
+/*
+ * Take the kernel send time of a probe from the error queue.  Returns 1 if
+ * the message was one, to be passed over by recverr().
+ */
+static int tx_stamp(struct run_state *const ctl, struct msghdr *msg)
+{
+	struct sock_extended_err const *e = NULL;
+	struct scm_timestamping const *tss = NULL;
+	struct cmsghdr *cmsg;
+	int i;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+		    (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+			e = (struct sock_extended_err const *)CMSG_DATA(cmsg);
+		else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
+			tss = (struct scm_timestamping const *)CMSG_DATA(cmsg);
+	}
+	if (!e || e->ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+		return 0;
+	if (!tss || e->ee_info != SCM_TSTAMP_SND || !tss->ts[0].tv_sec)
+		return 1;
+	for (i = 0; i < ctl->his_size; i++)
+		if (ctl->his[i].hops && ctl->his[i].tskey == e->ee_data) {
+			ctl->his[i].txstamp = tss->ts[0];
+			break;
+		}
+	return 1;
+}
+
+/*
+ * Drain the error queue.  Every error is matched to the hop its probe was
+ * sent to, through the history slot of its destination port or the ttl
+ * echoed in the payload, and handed on as a hop_reply.
+ */
+static void recverr(struct run_state *const ctl)
+{
+	ssize_t recv_size;
+	struct probehdr rcvbuf;
+	char cbuf[ANCILLARY_DATA_LEN];
+	struct cmsghdr *cmsg;
+	struct sock_extended_err *e;
+	struct sockaddr_storage addr;
+	struct timespec ts;
+	struct timespec *retts;
+	struct timespec txstamp = { 0 };
+	struct timespec rxstamp = { 0 };
+	struct hop_reply r;
+	int slot;
+	int rethops;
+	int sndhops;
+	int sent_mtu;
+	int flow;
+	int broken_router;
+	struct iovec iov = {
+		.iov_base = &rcvbuf,
+		.iov_len = sizeof(rcvbuf)
+	};
+	struct msghdr msg;
+	const struct msghdr reset = {
+		.msg_name = (uint8_t *)&addr,
+		.msg_namelen = sizeof(addr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = sizeof(cbuf),
+		0
+	};
+
+ restart:
+	memset(&rcvbuf, -1, sizeof(rcvbuf));
+	msg = reset;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	recv_size = recvmsg(ctl->socket_fd, &msg, MSG_ERRQUEUE);
+	if (recv_size < 0) {
+		if (errno == EAGAIN)
+			return;
+		goto restart;
+	}
+	if (tx_stamp(ctl, &msg))
+		goto restart;
+
+	rethops = -1;
+	sndhops = -1;
+	sent_mtu = 0;
+	e = NULL;
+	retts = NULL;
+	broken_router = 0;
+	flow = -1;
+
+	slot = find_slot(ctl, &addr, &rcvbuf, recv_size);
+	if (slot >= 0) {
+		sndhops = ctl->his[slot].hops;
+		retts = &ctl->his[slot].sendtime;
+		sent_mtu = ctl->his[slot].mtu;
+		flow = ctl->his[slot].port - ctl->base_port;
+		txstamp = ctl->his[slot].txstamp;
+		ctl->his[slot].hops = 0;
+	}
+	if (recv_size == sizeof(rcvbuf)) {
+		if (rcvbuf.ttl == 0 || (rcvbuf.ts.tv_sec == 0 && rcvbuf.ts.tv_nsec == 0))
+			broken_router = 1;
+		else {
+			sndhops = rcvbuf.ttl;
+			retts = &rcvbuf.ts;
+		}
+	}
+
+	/* Local IPv4 errors do not carry the port of an unconnected socket. */
+	if (sndhops <= 0)
+		sndhops = ctl->sending_ttl;
+	/* Late answer to a retransmitted probe, or beyond the destination. */
+	if (sndhops <= 0 || sndhops > ctl->last_ttl ||
+	    (!ctl->continuous && ctl->hop[sndhops].done))
+		goto restart;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		switch (cmsg->cmsg_level) {
+		case SOL_IPV6:
+			switch (cmsg->cmsg_type) {
+			case IPV6_RECVERR:
+				e = (struct sock_extended_err *)CMSG_DATA(cmsg);
+				break;
+			case IPV6_HOPLIMIT:
+#ifdef IPV6_2292HOPLIMIT
+			case IPV6_2292HOPLIMIT:
+#endif
+				memcpy(&rethops, CMSG_DATA(cmsg), sizeof(rethops));
+				break;
+			default:
+				if (!ctl->continuous)
+					hop_printf(ctl, sndhops, _("cmsg6:%d\n "), cmsg->cmsg_type);
+			}
+			break;
+		case SOL_IP:
+			switch (cmsg->cmsg_type) {
+			case IP_RECVERR:
+				e = (struct sock_extended_err *)CMSG_DATA(cmsg);
+				break;
+			case IP_TTL:
+				rethops = *(uint8_t *)CMSG_DATA(cmsg);
+				break;
+			default:
+				if (!ctl->continuous)
+					hop_printf(ctl, sndhops, _("cmsg4:%d\n "), cmsg->cmsg_type);
+			}
+			break;
+		case SOL_SOCKET:
+			if (cmsg->cmsg_type == SCM_TIMESTAMPING)
+				rxstamp = ((struct scm_timestamping *)CMSG_DATA(cmsg))->ts[0];
+		}
+	}
+	/* Counted as lost already, or not to be told from other probes. */
+	if ((ctl->continuous || ctl->multipath) && slot < 0 && e &&
+	    e->ee_origin != SO_EE_ORIGIN_LOCAL)
+		goto restart;
+	if (e == NULL) {
+		if (!ctl->continuous) {
+			hop_printf(ctl, sndhops, _("no info\n"));
+			hop_done(ctl, sndhops, 1);
+		}
+		goto restart;
+	}
+	/* Sent before an earlier report lowered the mtu, just try again. */
+	if (!ctl->continuous && !ctl->plpmtud && e->ee_errno == EMSGSIZE &&
+	    sent_mtu > ctl->mtu && (int)e->ee_info >= ctl->mtu) {
+		ctl->hop[sndhops].resend = 1;
+		goto restart;
+	}
+
+	if (rethops <= 64)
+		rethops = 65 - rethops;
+	else if (rethops <= 128)
+		rethops = 129 - rethops;
+	else
+		rethops = 256 - rethops;
+
+	r.ttl = sndhops;
+	r.e = e;
+	r.offender = (struct sockaddr *)(e + 1);
+	r.rethops = rethops;
+	r.broken_router = broken_router;
+	r.flow = flow;
+	r.size = sent_mtu;
+	r.rtt = -1;
+	/*
+	 * Kernel timestamps leave out the scheduling and system call delays on
+	 * both ends, which is most of the rtt on a short path.
+	 */
+	if (rxstamp.tv_sec && txstamp.tv_sec && e->ee_origin != SO_EE_ORIGIN_LOCAL) {
+		struct timespec res;
+
+		timespecsub(&rxstamp, &txstamp, &res);
+		r.rtt = res.tv_sec * 1000000 + res.tv_nsec / 1000;
+	} else if (retts) {
+		struct timespec res;
+
+		timespecsub(&ts, retts, &res);
+		r.rtt = res.tv_sec * 1000000 + res.tv_nsec / 1000;
+		txstamp.tv_sec = 0;
+	}
+	if (r.rtt >= 0 &&
+	    (e->ee_origin == SO_EE_ORIGIN_ICMP || e->ee_origin == SO_EE_ORIGIN_ICMP6)) {
+		if (txstamp.tv_sec)
+			ctl->kernel_rtts++;
+		else
+			ctl->user_rtts++;
+		/* A pmtu report comes from some hop before, not from this one. */
+		if (e->ee_errno != EMSGSIZE)
+			hop_rtt_sample(&ctl->hop[sndhops], r.rtt);
+	}
+	if (ctl->plpmtud)
+		pl_reply(ctl, &r);
+	else if (ctl->multipath)
+		mda_reply(ctl, &r);
+	else if (ctl->continuous)
+		account_reply(ctl, &r);
+	else
+		print_reply(ctl, &r);
+	goto restart;
+}
+
+static void set_ttl(struct run_state *const ctl, int ttl)
+{
+	int on = ttl;
+
+	switch (ctl->ai->ai_family) {
+	case AF_INET6:
+		if (setsockopt(ctl->socket_fd, SOL_IPV6, IPV6_UNICAST_HOPS, &on, sizeof(on)))
+			error(1, errno, "IPV6_UNICAST_HOPS");
+		if (!ctl->mapped)
+			break;
+		/*FALLTHROUGH*/
+	case AF_INET:
+		if (setsockopt(ctl->socket_fd, SOL_IP, IP_TTL, &on, sizeof(on)))
+			error(1, errno, "IP_TTL");
+	}
+}
+
+/*
+ * Ask for kernel send times, best effort, the rtts are taken in userspace
+ * without.  The kernel numbers the probes from 0 when the ids are turned
+ * on, which is how the count is started over after a failed send: the
+ * kernel uses a number up for some of them and not for others.
+ */
+static void tx_stamps_on(struct run_state *const ctl)
+{
+#ifdef SO_TIMESTAMPING
+	int on = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+		 SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_TSONLY;
+	int i;
+
+	setsockopt(ctl->socket_fd, SOL_SOCKET, SO_TIMESTAMPING, &on, sizeof(on));
+	on |= SOF_TIMESTAMPING_OPT_ID;
+	setsockopt(ctl->socket_fd, SOL_SOCKET, SO_TIMESTAMPING, &on, sizeof(on));
+	ctl->tskey = 0;
+	/* Late stamps of the probes in flight carry the old numbers. */
+	for (i = 0; i < ctl->his_size; i++)
+		ctl->his[i].tskey = UINT32_MAX;
+#else
+	(void)ctl;
+#endif
+}
+
+/*
+ * Send one probe to hop ttl.  A failed send is usually a local pmtu
+ * report, which recverr() takes from the error queue before the probe is
+ * sent again with the lowered size.
+ */
+static void probe_ttl(struct run_state *const ctl, int ttl)
+{
+	int i;
+	struct probehdr *hdr = ctl->pktbuf;
+	struct hop *hop = &ctl->hop[ttl];
+
+	set_ttl(ctl, ttl);
+	ctl->sending_ttl = ttl;
+	for (i = 0; i < MAX_PROBES; i++) {
+		int slot = ctl->hisptr;
+		uint16_t port = ctl->base_port;
+
+		/* The port is part of the flow, which ECMP routers hash on. */
+		if (ctl->multipath)
+			port += ctl->flow;
+		else if (!ctl->flow_stable)
+			port += slot;
+		hdr->ttl = ttl;
+		switch (ctl->ai->ai_family) {
+		case AF_INET6:
+			((struct sockaddr_in6 *)&ctl->target)->sin6_port = htons(port);
+			break;
+		case AF_INET:
+			((struct sockaddr_in *)&ctl->target)->sin_port = htons(port);
+			break;
+		}
+		ctl->hisptr = (ctl->hisptr + 1) & (ctl->his_size - 1);
+		/* Still unanswered, a continuous mode probe is lost now. */
+		if (ctl->his[slot].hops && ctl->continuous)
+			ctl->hop[ctl->his[slot].hops].lost++;
+		clock_gettime(CLOCK_MONOTONIC, &hdr->ts);
+		ctl->his[slot].hops = ttl;
+		ctl->his[slot].sendtime = hdr->ts;
+		ctl->his[slot].mtu = ctl->mtu;
+		ctl->his[slot].port = port;
+		ctl->his[slot].tskey = ctl->tskey;
+		ctl->his[slot].txstamp.tv_sec = 0;
+		if (sendto(ctl->socket_fd, ctl->pktbuf, ctl->mtu - ctl->overhead, 0,
+			   (struct sockaddr *)&ctl->target, ctl->targetlen) > 0) {
+			ctl->tskey++;
+			ctl->dt.probes++;
+			hop->tries++;
+			hop->sendtime = hdr->ts;
+			break;
+		}
+		recverr(ctl);
+		ctl->his[slot].hops = 0;
+		tx_stamps_on(ctl);
+		if (hop->done)
+			break;
+		hop->resend = 0;
+	}
+	ctl->sending_ttl = 0;
+
+	if (i == MAX_PROBES) {
+		hop_printf(ctl, ttl, _("%2d:  send failed\n"), ttl);
+		hop_done(ctl, ttl, 1);
+	}
+}
+
+/*
+ * Send a hop its next probe when the last one timed out, or give up on it,
+ * and lower *timeout to the msecs until its probe in flight times out.
+ */
+static void hop_tick(struct run_state *const ctl, int ttl, struct timespec const *const now,
+		     int *timeout)
+{
+	struct hop *hop = &ctl->hop[ttl];
+	long ms;
+
+	if (hop->done)
+		return;
+	/* Estimates improve as replies come in, so check every time. */
+	ms = hop_timeout_ms(ctl, ttl, hop->tries - 1) - timespec_diff_ms(now, &hop->sendtime);
+	if (hop->resend) {
+		hop->resend = 0;
+		probe_ttl(ctl, ttl);
+	} else if (ms <= 0) {
+		if (hop->tries < HOP_TRIES)
+			probe_ttl(ctl, ttl);
+		else {
+			hop_printf(ctl, ttl, _("%2d:  no reply\n"), ttl);
+			hop_done(ctl, ttl, 0);
+		}
+	}
+	if (hop->done)
+		return;
+	ms = hop_timeout_ms(ctl, ttl, hop->tries - 1) - timespec_diff_ms(now, &hop->sendtime);
+	if (ms < 0)
+		ms = 0;
+	if (*timeout < 0 || ms < *timeout)
+		*timeout = ms;
+}
+
+/*
+ * Print the hops that are complete, in order.  A hop whose names are still
+ * being looked up is held back until they arrive or its budget runs out,
+ * *wait is set to the msecs left then.  Returns 1 at the end of the path.
+ */
+static int flush_hops(struct run_state *const ctl, long *wait)
+{
+	struct timespec now;
+
+	*wait = -1;
+	names_drain(ctl);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	while (ctl->print_ttl <= ctl->last_ttl && ctl->hop[ctl->print_ttl].done) {
+		struct hop *hop = &ctl->hop[ctl->print_ttl];
+
+		/* Multi-destination mode prints a path once it is complete. */
+		if (!ctl->doubletree) {
+			if (!hop_names_ready(ctl, hop, &now)) {
+				*wait = timespec_diff_ms(&hop->names_by, &now);
+				break;
+			}
+			hop_write(ctl, hop);
+		}
+		if (hop->final)
+			return 1;
+		ctl->print_ttl++;
+	}
+	fflush(stdout);
+	return 0;
+}
+
+/*
+ * Probe a window of consecutive hops from first to last at once, retry the
+ * ones that time out and print the results in order as they complete.
+ * Returns 1 when the path ended by last.
+ */
+static int trace(struct run_state *const ctl, int first, int last)
+{
+	struct pollfd pfd[2] = {
+		{
+			.fd = ctl->socket_fd,
+			.events = POLLIN | POLLERR
+		},
+		{
+			.fd = ctl->names.pipe[0],
+			.events = POLLIN
+		}
+	};
+
+	ctl->last_ttl = last;
+	ctl->print_ttl = first;
+	ctl->next_ttl = first;
+
+	while (1) {
+		struct timespec now;
+		long wait;
+		int timeout = -1;
+		int ttl;
+
+		while (ctl->next_ttl <= ctl->last_ttl && ctl->next_ttl < ctl->print_ttl + ctl->window) {
+			/* Answered already while checking a cached path. */
+			if (!ctl->hop[ctl->next_ttl].done)
+				probe_ttl(ctl, ctl->next_ttl);
+			ctl->next_ttl++;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for (ttl = ctl->print_ttl; ttl < ctl->next_ttl && ttl <= ctl->last_ttl; ttl++)
+			hop_tick(ctl, ttl, &now, &timeout);
+
+		if (flush_hops(ctl, &wait))
+			return 1;
+		if (ctl->print_ttl > ctl->last_ttl)
+			return 0;
+		if (wait >= 0 && (timeout < 0 || wait < timeout))
+			timeout = wait;
+		/* Nothing in flight, the window moved on. */
+		if (timeout < 0)
+			continue;
+
+		if (poll(pfd, 2, timeout) <= 0)
+			continue;
+		if (pfd[0].revents & POLLERR)
+			recverr(ctl);
+		if ((pfd[0].revents & POLLIN) &&
+		    recv(ctl->socket_fd, ctl->pktbuf, ctl->mtu, MSG_DONTWAIT) > 0) {
+			for (ttl = ctl->print_ttl; ttl <= ctl->last_ttl && ctl->hop[ttl].done; ttl++)
+				;
+			if (ttl <= ctl->last_ttl) {
+				hop_printf(ctl, ttl, _("%2d?: reply received 8)\n"), ttl);
+				hop_done(ctl, ttl, 1);
+			}
+		}
+	}
+}
+
+/*
+ * Count the continuous mode probes past their timeout as lost.  Returns the
+ * msecs until the next one expires, -1 if none is in flight.
+ */
+static long expire_probes(struct run_state *const ctl, struct timespec const *const now)
+{
+	long next = -1;
+	int i;
+
+	for (i = 0; i < ctl->his_size; i++) {
+		struct hhistory *his = &ctl->his[i];
+		long ms;
+
+		if (!his->hops)
+			continue;
+		ms = hop_timeout_ms(ctl, his->hops, 0) - timespec_diff_ms(now, &his->sendtime);
+		if (ms <= 0) {
+			ctl->hop[his->hops].lost++;
+			his->hops = 0;
+			continue;
+		}
+		if (next < 0 || ms < next)
+			next = ms;
+	}
+	return next;
+}
+
+static void print_ms(long usec)
+{
+	printf(" %4ld.%03ld", usec / 1000, usec % 1000);
+}
+
+/* Why the path ended at a hop, 0 if it did not. */
+static void print_path_end(int ee_errno)
+{
+	switch (ee_errno) {
+	case 0:
+		break;
+	case ECONNREFUSED:
+		printf(_(" reached"));
+		break;
+	case EHOSTUNREACH:
+		printf(" !H");
+		break;
+	case ENETUNREACH:
+		printf(" !N");
+		break;
+	case EACCES:
+		printf(" !A");
+		break;
+	case EPROTO:
+		printf(" !P");
+		break;
+	default:
+		printf(" %s", strerror(ee_errno));
+	}
+}
+
+/* Where the hop rtts came from. */
+static char const *ts_source(struct run_state const *const ctl)
+{
+	if (!ctl->kernel_rtts)
+		return _("userspace");
+	if (!ctl->user_rtts)
+		return _("kernel");
+	return _("kernel and userspace");
+}
+
+static void print_table(struct run_state *const ctl, long round, int redraw)
+{
+	char name[2 * NI_MAXHOST + 4];
+	int ttl;
+
+	names_drain(ctl);
+	if (redraw)
+		printf("\033[H\033[J");
+	printf(_("round %ld, pmtu %d, timestamps %s\n"), round, ctl->mtu, ts_source(ctl));
+	printf(_("%4s  %-40s %6s %5s %8s %8s %8s %8s %8s %8s %8s\n"), _("hop"), _("host"),
+	       _("loss"), _("sent"), _("last"), _("min"), _("avg"), _("p50"), _("p90"),
+	       _("max"), _("jitter"));
+	for (ttl = 1; ttl <= ctl->last_ttl; ttl++) {
+		struct hop *hop = &ctl->hop[ttl];
+		struct responder *best = NULL;
+		long done = hop->rtt.count + hop->lost;
+		int i;
+
+		for (i = 0; i < hop->nresp; i++)
+			if (!best || hop->resp[i].count > best->count)
+				best = &hop->resp[i];
+		if (best)
+			name_format(ctl, best->name, name, sizeof(name));
+		else
+			strcpy(name, "???");
+		printf("%3d:  %-40s", ttl, name);
+		if (done)
+			printf(" %5.1f%%", hop->lost * 100.0 / done);
+		else
+			printf(" %6s", "-");
+		printf(" %5d", hop->tries);
+		if (hop->rtt.count) {
+			print_ms(hop->last_rtt);
+			print_ms(hop->rtt.min);
+			print_ms(rtt_stats_avg(&hop->rtt));
+			print_ms(rtt_stats_percentile(&hop->rtt, 50));
+			print_ms(rtt_stats_percentile(&hop->rtt, 90));
+			print_ms(hop->rtt.max);
+			print_ms(hop->rtt.count > 1 ? hop->jitter_sum / (hop->rtt.count - 1) : 0);
+		}
+		print_path_end(hop->ee_errno);
+		putchar('\n');
+		/* Other routers seen at this hop, the path changed or is balanced. */
+		for (i = 0; i < hop->nresp; i++)
+			if (&hop->resp[i] != best) {
+				name_format(ctl, hop->resp[i].name, name, sizeof(name));
+				printf("      %-40s %ld\n", name, hop->resp[i].count);
+			}
+	}
+	fflush(stdout);
+}
+
+static void sigexit(int signo __attribute__((__unused__)))
+{
+	exiting = 1;
+}
+
+/*
+ * The number of answers after which k + 1 interfaces equally likely to be
+ * taken would all have shown up, but for the chance not covered by the
+ * confidence: the smallest n with (k + 1) (k / (k + 1))^n below it.
+ */
+static void mda_setup(struct run_state *const ctl)
+{
+	double alpha = (100 - ctl->confidence) / 100.0;
+	int k;
+
+	for (k = 1; k <= MDA_MAX_IFACES; k++) {
+		double miss = k + 1;
+		int n = 0;
+
+		while (miss > alpha) {
+			miss = miss * k / (k + 1);
+			n++;
+		}
+		ctl->mda_needed[k] = n;
+	}
+	ctl->mda_needed[0] = ctl->mda_needed[1];
+}
+
+/* Whether a hop needs another flow, unless most of them go unanswered. */
+static int mda_more(struct run_state const *const ctl, struct mda_hop const *const mh)
+{
+	if (mh->nsent == MDA_MAX_FLOWS || mh->niface == MDA_MAX_IFACES ||
+	    mh->silent > HOP_TRIES + mh->answered)
+		return 0;
+	return mh->answered + mh->inflight < ctl->mda_needed[mh->niface];
+}
+
+/*
+ * Give up on the flows of this hop past their timeout.  Returns the msecs
+ * until the next one is due, -1 if none is in flight.
+ */
+static long mda_expire(struct run_state *const ctl, struct mda_hop *const mh,
+		       struct timespec const *const now)
+{
+	long next = -1;
+	int i;
+
+	for (i = 0; i < ctl->his_size; i++) {
+		struct hhistory *his = &ctl->his[i];
+		long ms;
+
+		if (his->hops != mh->ttl)
+			continue;
+		ms = hop_timeout_ms(ctl, mh->ttl, 0) - timespec_diff_ms(now, &his->sendtime);
+		if (ms <= 0) {
+			mh->state[his->port - ctl->base_port] = MDA_SILENT;
+			mh->silent++;
+			mh->inflight--;
+			his->hops = 0;
+			continue;
+		}
+		if (next < 0 || ms < next)
+			next = ms;
+	}
+	return next;
+}
+
+static void mda_print_hop(struct run_state *const ctl, struct mda_hop const *const mh)
+{
+	struct mda_hop const *prev = ctl->mda_prev;
+	int i;
+	int j;
+
+	if (!mh->niface && !mh->overflow) {
+		printf(_("%2d:  no reply\n"), mh->ttl);
+		return;
+	}
+	/* Start all the lookups before waiting for the first. */
+	for (i = 0; i < mh->niface; i++)
+		name_lookup(ctl, (struct sockaddr const *)&mh->iface[i].addr);
+	for (i = 0; i < mh->niface; i++) {
+		struct mda_iface const *ifc = &mh->iface[i];
+		int plen;
+
+		if (mh->niface > 1)
+			printf("%2d%c: ", mh->ttl, 'a' + i);
+		else
+			printf("%2d:  ", mh->ttl);
+		plen = print_names(ctl, (struct sockaddr const *)&ifc->addr);
+		if (plen >= HOST_COLUMN_SIZE)
+			plen = HOST_COLUMN_SIZE - 1;
+		printf("%*s", HOST_COLUMN_SIZE - plen, "");
+		if (ifc->rtt_min >= 0)
+			printf(_("%3ld.%03ldms "), ifc->rtt_min / 1000, ifc->rtt_min % 1000);
+		printf(_("%d/%d flows"), ifc->flows, mh->answered);
+		/* The links only tell something after a branch. */
+		if (prev && prev->niface > 1 && ifc->pred) {
+			printf(_(" via"));
+			for (j = 0; j < prev->niface; j++)
+				if (ifc->pred & (1U << j))
+					printf(" %d%c", prev->ttl, 'a' + j);
+		}
+		print_path_end(ifc->ee_errno);
+		putchar('\n');
+	}
+	if (mh->overflow)
+		printf(_("     and more, %d flows\n"), mh->overflow);
+	if (mh->pmtu)
+		printf(_("     pmtu %d\n"), mh->pmtu);
+	fflush(stdout);
+}
+
+/*
+ * Multipath mode, after the Multipath Detection Algorithm: every hop gets
+ * as many flows as it takes to find all the interfaces load balancing
+ * spreads them over, with the confidence asked for.  Flow n is sent to
+ * port base_port + n at every hop, so its interfaces at consecutive hops
+ * are linked.  Returns 1 when the path ended before max_hops.
+ */
+static int multipath(struct run_state *const ctl)
+{
+	struct pollfd pfd = {
+		.fd = ctl->socket_fd,
+		.events = POLLIN | POLLERR
+	};
+	struct mda_hop *hops;
+	int ttl;
+	int ret = 0;
+
+	hops = calloc(2, sizeof(*hops));
+	if (!hops)
+		error(1, errno, "calloc");
+	mda_setup(ctl);
+	ctl->last_ttl = ctl->max_hops;
+
+	for (ttl = 1; ttl <= ctl->max_hops && !ret; ttl++) {
+		struct mda_hop *mh = &hops[ttl & 1];
+		int i;
+
+		memset(mh, 0, sizeof(*mh));
+		mh->ttl = ttl;
+		for (i = 0; i < MDA_MAX_FLOWS; i++)
+			mh->state[i] = MDA_UNSENT;
+		ctl->mda = mh;
+		ctl->mda_prev = ttl > 1 ? &hops[(ttl - 1) & 1] : NULL;
+
+		while (1) {
+			struct timespec now;
+			long timeout;
+
+			/* The lowest flows first, they were seen at the hop before. */
+			while (mda_more(ctl, mh) && mh->inflight < ctl->window) {
+				for (i = 0; mh->state[i] != MDA_UNSENT; i++)
+					;
+				ctl->flow = i;
+				mh->state[i] = MDA_INFLIGHT;
+				mh->nsent++;
+				mh->inflight++;
+				probe_ttl(ctl, ttl);
+				if (ctl->hop[ttl].done) {
+					hop_write(ctl, &ctl->hop[ttl]);
+					free(hops);
+					return 1;
+				}
+			}
+			if (!mh->inflight)
+				break;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			timeout = mda_expire(ctl, mh, &now);
+			if (timeout < 0 || poll(&pfd, 1, timeout) <= 0)
+				continue;
+			if (pfd.revents & POLLERR)
+				recverr(ctl);
+			if (pfd.revents & POLLIN)
+				while (recv(ctl->socket_fd, ctl->pktbuf, ctl->mtu, MSG_DONTWAIT) > 0)
+					;
+		}
+		mda_print_hop(ctl, mh);
+		ret = mh->final;
+	}
+	free(hops);
+	return ret;
+}
+
+/* Wait for the replies to the probes in flight, at most ms msecs. */
+static void pl_wait(struct run_state *const ctl, long ms)
+{
+	struct pollfd pfd = {
+		.fd = ctl->socket_fd,
+		.events = POLLIN | POLLERR
+	};
+
+	if (poll(&pfd, 1, ms) <= 0)
+		return;
+	if (pfd.revents & POLLERR)
+		recverr(ctl);
+	/* An answer from a service at the port, the probe got there. */
+	if ((pfd.revents & POLLIN) &&
+	    recv(ctl->socket_fd, ctl->pktbuf, ctl->mtu, MSG_DONTWAIT) > 0 &&
+	    !ctl->pl.scan && ctl->pl.outcome == PL_PENDING)
+		ctl->pl.outcome = PL_OK;
+}
+
+/*
+ * Send probes of one size to the destination until one is answered, up
+ * to HOP_TRIES.  The interface may lower the size on the way, pl.size
+ * tells the size that was sent.
+ */
+static int pl_probe(struct run_state *const ctl, int size)
+{
+	struct pl_state *pl = &ctl->pl;
+	int tries;
+
+	pl->outcome = PL_PENDING;
+	for (tries = 0; tries < HOP_TRIES; tries++) {
+		struct timespec sent;
+		struct timespec now;
+		long ms;
+
+		ctl->mtu = size;
+		probe_ttl(ctl, ctl->max_hops);
+		if (ctl->hop[ctl->max_hops].done) {
+			pl->ee_errno = EIO;
+			return PL_FAILED;
+		}
+		pl->size = size = ctl->mtu;
+		clock_gettime(CLOCK_MONOTONIC, &sent);
+		do {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			ms = hop_timeout_ms(ctl, ctl->max_hops, tries) - timespec_diff_ms(&now, &sent);
+			if (ms > 0)
+				pl_wait(ctl, ms);
+		} while (ms > 0 && pl->outcome == PL_PENDING);
+		if (pl->outcome != PL_PENDING)
+			break;
+	}
+	return pl->outcome;
+}
+
+/*
+ * Find where probes of the size that vanished get lost.  Every hop gets
+ * one of that size and one of the pmtu found, and the black hole is past
+ * the last hop that answered the big one.  A silent router makes the
+ * place less certain, so the next hop that answered is reported as well.
+ */
+static void pl_scan(struct run_state *const ctl, int small, int big)
+{
+	struct pl_state *pl = &ctl->pl;
+	int last = ctl->max_hops;
+	int round;
+	int ttl;
+	int h = 0;
+
+	pl->scan = calloc(ctl->max_hops + 1, sizeof(*pl->scan));
+	if (!pl->scan)
+		error(1, errno, "calloc");
+	pl->scan_small = small;
+	pl->scan_big = big;
+
+	for (round = 0; round < HOP_TRIES; round++) {
+		struct timespec start;
+		struct timespec now;
+		int missing = 0;
+		long ms;
+
+		for (ttl = 1; ttl <= last; ttl++) {
+			struct pl_hop *ph = &pl->scan[ttl];
+			int i;
+
+			/* Beyond the destination, nothing is to be learned. */
+			if (ph->reached && last > ttl) {
+				last = ttl;
+				ctl->hops_to = ttl;
+			}
+			for (i = 0; i < 2; i++) {
+				if (ph->ok[i])
+					continue;
+				ctl->mtu = i ? big : small;
+				probe_ttl(ctl, ttl);
+				missing++;
+			}
+		}
+		if (!missing)
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		do {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			ms = hop_timeout_ms(ctl, last, round) - timespec_diff_ms(&now, &start);
+			if (ms > 0)
+				pl_wait(ctl, ms);
+		} while (ms > 0);
+	}
+
+	for (ttl = 1; ttl <= last; ttl++)
+		if (pl->scan[ttl].ok[1])
+			h = ttl;
+	printf(_("     black hole: %d bytes get lost past "), big);
+	if (h) {
+		printf(_("hop %d: "), h);
+		print_names(ctl, (struct sockaddr *)&pl->scan[h].addr);
+	} else
+		printf(_("this host"));
+	for (ttl = h + 1; ttl <= last; ttl++)
+		if (pl->scan[ttl].ok[0]) {
+			if (ttl > h + 1) {
+				printf(_(", before hop %d: "), ttl);
+				print_names(ctl, (struct sockaddr *)&pl->scan[ttl].addr);
+			}
+			break;
+		}
+	putchar('\n');
+	free(pl->scan);
+	pl->scan = NULL;
+}
+
+/*
+ * Packet layer pmtu discovery, as in RFC 4821 and RFC 8899: binary search
+ * for the largest size that gets to the destination, with DF set.  The
+ * base size goes first, and gives the timeouts an rtt to start from, then
+ * the largest size, which is all it takes on most paths.  A too big report
+ * bounds the search as in the classic mode, and its pmtu is tried right
+ * away.  A size that stays unanswered HOP_TRIES times counts as too big
+ * too, which finds the black holes that filter the reports.
+ */
+static void pmtu_search(struct run_state *const ctl)
+{
+	struct pl_state *pl = &ctl->pl;
+	int base = ctl->overhead == DEFAULT_OVERHEAD_IPV6 ? PL_BASE_IPV6 : PL_BASE_IPV4;
+	int vanished = 0;
+	int fresh = 0;
+	int lo = 0;
+	int hi = ctl->mtu;
+
+	ctl->last_ttl = ctl->max_hops;
+	while (!lo || lo < hi) {
+		int size;
+
+		if (!lo)
+			size = base < hi ? base : hi;
+		else if (fresh)
+			size = hi;
+		else
+			size = lo + (hi - lo + 1) / 2;
+		fresh = 0;
+
+		pl_probe(ctl, size);
+		/* Lowered by the interface mtu. */
+		if (pl->size < size)
+			hi = size = pl->size;
+		printf(_("     size %5d: "), size);
+		switch (pl->outcome) {
+		case PL_OK:
+			printf(_("reached"));
+			if (pl->rtt >= 0)
+				printf(_(" %ld.%03ldms"), pl->rtt / 1000, pl->rtt % 1000);
+			fresh = !lo;
+			lo = size;
+			break;
+		case PL_TOO_BIG:
+			printf(_("pmtu %d from "), pl->reported);
+			print_names(ctl, (struct sockaddr *)&pl->from);
+			fresh = pl->reported < size;
+			hi = fresh ? pl->reported : size - 1;
+			break;
+		case PL_PENDING:
+			printf(_("no reply"));
+			hi = size - 1;
+			if (!vanished || size < vanished)
+				vanished = size;
+			break;
+		case PL_FAILED:
+			if (pl->ee_errno)
+				print_path_end(pl->ee_errno);
+			else
+				printf(_("too many hops"));
+			putchar('\n');
+			return;
+		}
+		putchar('\n');
+		fflush(stdout);
+		if (!lo && (hi <= ctl->overhead || (hi < base && pl->outcome == PL_PENDING))) {
+			printf(_("     no reply from the destination\n"));
+			return;
+		}
+	}
+	if (vanished)
+		pl_scan(ctl, lo, vanished);
+	ctl->mtu = lo;
+}
+
+/* Print complete hops with their names, as far as they are known in time. */
+static void print_hops(struct run_state *const ctl, int first, int last)
+{
+	struct pollfd pfd = {
+		.fd = ctl->names.pipe[0],
+		.events = POLLIN
+	};
+	int ttl;
+
+	for (ttl = first; ttl <= last; ttl++) {
+		struct hop *hop = &ctl->hop[ttl];
+		struct timespec now;
+
+		while (1) {
+			names_drain(ctl);
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (hop_names_ready(ctl, hop, &now))
+				break;
+			poll(&pfd, 1, timespec_diff_ms(&hop->names_by, &now));
+		}
+		hop_write(ctl, hop);
+	}
+	fflush(stdout);
+}
+
+static void print_resume(struct run_state const *const ctl)
+{
+	printf(_("     Resume: pmtu %d "), ctl->mtu);
+	if (ctl->hops_to >= 0)
+		printf(_("hops %d "), ctl->hops_to);
+	if (ctl->hops_from >= 0)
+		printf(_("back %d "), ctl->hops_from);
+	printf("\n");
+}
+
+static int stop_find(struct run_state const *const ctl, struct sockaddr const *const sa, int ttl)
+{
+	struct doubletree const *dt = &ctl->dt;
+	uint8_t key[16];
+	int i;
+
+	if (!dt->bucket)
+		return 0;
+	addr_key(sa, key);
+	for (i = dt->bucket[key_hash(key, ttl) % STOP_BUCKETS]; i; i = dt->stop[i - 1].next) {
+		struct stop_entry const *se = &dt->stop[i - 1];
+
+		if (se->ttl == ttl && se->family == sa->sa_family && !memcmp(se->key, key, sizeof(key)))
+			return 1;
+	}
+	return 0;
+}
+
+static void stop_add(struct run_state *const ctl, struct sockaddr const *const sa, int ttl)
+{
+	struct doubletree *dt = &ctl->dt;
+	struct stop_entry *se;
+	uint32_t h;
+
+	if (stop_find(ctl, sa, ttl))
+		return;
+	if (!dt->bucket) {
+		dt->bucket = calloc(STOP_BUCKETS, sizeof(*dt->bucket));
+		if (!dt->bucket)
+			error(1, errno, "calloc");
+	}
+	if (dt->nstop == dt->stop_alloc) {
+		int n = dt->stop_alloc ? dt->stop_alloc * 2 : 256;
+
+		se = realloc(dt->stop, n * sizeof(*se));
+		if (!se)
+			error(1, errno, "realloc");
+		dt->stop = se;
+		dt->stop_alloc = n;
+	}
+	se = &dt->stop[dt->nstop];
+	se->family = sa->sa_family;
+	addr_key(sa, se->key);
+	se->ttl = ttl;
+	h = key_hash(se->key, ttl) % STOP_BUCKETS;
+	se->next = dt->bucket[h];
+	dt->bucket[h] = ++dt->nstop;
+}
+
+/* One destination per line, the first word of it, # starts a comment. */
+static void dt_read(struct run_state *const ctl, char const *const path)
+{
+	struct doubletree *dt = &ctl->dt;
+	FILE *fp = stdin;
+	char *line = NULL;
+	size_t size = 0;
+	int alloc = 0;
+
+	if (strcmp(path, "-") && !(fp = fopen(path, "r")))
+		error(2, errno, "%s", path);
+	while (getline(&line, &size, fp) >= 0) {
+		char *dest;
+
+		line[strcspn(line, "#")] = 0;
+		dest = strtok(line, " \t\r\n");
+		if (!dest)
+			continue;
+		if (dt->ndests == alloc) {
+			char **d;
+
+			alloc = alloc ? alloc * 2 : 64;
+			d = realloc(dt->dests, alloc * sizeof(*d));
+			if (!d)
+				error(1, errno, "realloc");
+			dt->dests = d;
+		}
+		dt->dests[dt->ndests] = strdup(dest);
+		if (!dt->dests[dt->ndests++])
+			error(1, errno, "strdup");
+	}
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	if (!dt->ndests)
+		error(2, 0, _("no destinations in %s"), path);
+}
+
+/* Aim the probes at another destination, of the family of the socket. */
+static int dt_target(struct run_state *const ctl, char const *const dest)
+{
+	struct addrinfo hints = {
+		.ai_family = ctl->ai->ai_family,
+		.ai_socktype = SOCK_DGRAM,
+		.ai_protocol = IPPROTO_UDP,
+#ifdef USE_IDN
+		.ai_flags = AI_IDN,
+#endif
+	};
+	struct addrinfo *result;
+	char pbuf[NI_MAXSERV];
+	int status;
+
+	sprintf(pbuf, "%u", ctl->base_port);
+	status = getaddrinfo(dest, pbuf, &hints, &result);
+	if (status || !result) {
+		error(0, 0, "%s: %s", dest, gai_strerror(status));
+		return 0;
+	}
+	memcpy(&ctl->target, result->ai_addr, result->ai_addrlen);
+	ctl->targetlen = result->ai_addrlen;
+	freeaddrinfo(result);
+	/* The socket options were set up for one kind of address only. */
+	if (ctl->ai->ai_family == AF_INET6 &&
+	    IN6_IS_ADDR_V4MAPPED(&((struct sockaddr_in6 *)&ctl->target)->sin6_addr) != ctl->mapped) {
+		error(0, 0, _("%s: cannot mix IPv4 mapped and IPv6 destinations"), dest);
+		return 0;
+	}
+	return 1;
+}
+
+/* Print a path with its names, as far as they are known in time. */
+static void dt_print_path(struct run_state *const ctl, int joined, int end)
+{
+	if (joined > 2)
+		printf(_("%2d-%d: known from an earlier path\n"), 1, joined - 1);
+	else if (joined == 2)
+		printf(_("%2d:  known from an earlier path\n"), 1);
+	print_hops(ctl, joined ? joined : 1, end);
+}
+
 /*
- * All includes, definitions, struct declarations, and global variables are
- * above.  After this comment all you can find is functions.
+ * Trace one destination of the multi-destination mode.  Paths from one
+ * place share most of their first hops, so those are probed backward from
+ * the middle and only until the path joins one seen before.
  */
-
-static void data_wait(struct run_state const *const ctl)
+static void dt_trace(struct run_state *const ctl, char const *const dest)
 {
-	fd_set fds;
-	struct timeval tv = {
-		.tv_sec = 1,
-		.tv_usec = 0
-	};
+	struct doubletree *dt = &ctl->dt;
+	int first = dt->first_ttl < ctl->max_hops ? dt->first_ttl : ctl->max_hops;
+	int reached;
+	int joined = 0;
+	int end;
+	int ttl;
+	int i;
 
-	FD_ZERO(&fds);
-	FD_SET(ctl->socket_fd, &fds);
-	select(ctl->socket_fd + 1, &fds, NULL, NULL, &tv);
+	printf(_("destination %s\n"), dest);
+	if (!dt_target(ctl, dest))
+		return;
+	memset(ctl->hop, 0, (ctl->max_hops + 1) * sizeof(*ctl->hop));
+	for (i = 0; i < ctl->his_size; i++)
+		ctl->his[i].hops = 0;
+	ctl->hops_to = -1;
+	ctl->hops_from = -1;
+	ctl->mtu = dt->mtu;
+
+	/* Forward to the end of the path. */
+	reached = trace(ctl, first, ctl->max_hops);
+	end = ctl->last_ttl;
+	/* Backward, until the path joins a known one. */
+	for (ttl = first - 1; ttl > 0; ttl--) {
+		struct hop *hop = &ctl->hop[ttl];
+
+		/* The destination, or a dead end, is nearer than first. */
+		if (trace(ctl, ttl, ttl)) {
+			reached = 1;
+			end = ttl;
+		}
+		if (hop->from.ss_family && stop_find(ctl, (struct sockaddr *)&hop->from, ttl)) {
+			joined = ttl;
+			dt->skipped += ttl - 1;
+			break;
+		}
+	}
+	for (ttl = joined ? joined : 1; ttl <= end; ttl++)
+		if (ctl->hop[ttl].from.ss_family)
+			stop_add(ctl, (struct sockaddr *)&ctl->hop[ttl].from, ttl);
+
+	dt_print_path(ctl, joined, end);
+	if (!reached)
+		printf(_("     Too many hops: pmtu %d\n"), ctl->mtu);
+	print_resume(ctl);
+	fflush(stdout);
 }
 
-static void print_host(struct run_state const *const ctl, char const *const a,
-		       char const *const b)
+static void doubletree(struct run_state *const ctl)
 {
-	int plen;
+	int i;
 
-	plen = printf("%s", a);
-	if (ctl->show_both)
-		plen += printf(" (%s)", b);
-	if (plen >= HOST_COLUMN_SIZE)
-		plen = HOST_COLUMN_SIZE - 1;
-	printf("%*s", HOST_COLUMN_SIZE - plen, "");
+	ctl->dt.mtu = ctl->mtu;
+	for (i = 0; i < ctl->dt.ndests; i++)
+		dt_trace(ctl, ctl->dt.dests[i]);
 }
 
-static int recverr(struct run_state *const ctl)
+static void cache_open(struct run_state *const ctl, char const *const path)
 {
-	ssize_t recv_size;
-	struct probehdr rcvbuf;
-	char cbuf[ANCILLARY_DATA_LEN];
-	struct cmsghdr *cmsg;
-	struct sock_extended_err *e;
-	struct sockaddr_storage addr;
-	struct timespec ts;
-	struct timespec *retts;
-	int slot = 0;
-	int rethops;
-	int sndhops;
-	int progress = -1;
-	int broken_router;
-	char hnamebuf[NI_MAXHOST] = "";
-	struct iovec iov = {
-		.iov_base = &rcvbuf,
-		.iov_len = sizeof(rcvbuf)
-	};
-	struct msghdr msg;
-	const struct msghdr reset = {
-		.msg_name = (uint8_t *)&addr,
-		.msg_namelen = sizeof(addr),
-		.msg_iov = &iov,
-		.msg_iovlen = 1,
-		.msg_control = cbuf,
-		.msg_controllen = sizeof(cbuf),
-		0
-	};
+	size_t size = sizeof(struct path_cache) + CACHE_SLOTS * sizeof(struct path_entry);
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		error(1, errno, "%s", path);
+	/* Two audits must not both set up a new file. */
+	flock(fd, LOCK_EX);
+	if (fstat(fd, &st))
+		error(1, errno, "%s", path);
+	if (st.st_size && (size_t)st.st_size != size)
+		error(1, 0, _("%s: not a path cache"), path);
+	if (!st.st_size && ftruncate(fd, size))
+		error(1, errno, "%s", path);
+	ctl->cache = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ctl->cache == MAP_FAILED)
+		error(1, errno, "mmap %s", path);
+	if (!st.st_size) {
+		memcpy(ctl->cache->magic, PATH_CACHE_MAGIC, sizeof(ctl->cache->magic));
+		ctl->cache->slots = CACHE_SLOTS;
+		ctl->cache->hops = CACHE_HOPS;
+	} else if (memcmp(ctl->cache->magic, PATH_CACHE_MAGIC, sizeof(ctl->cache->magic)) ||
+		   ctl->cache->slots != CACHE_SLOTS || ctl->cache->hops != CACHE_HOPS)
+		error(1, 0, _("%s: not a path cache"), path);
+	flock(fd, LOCK_UN);
+	ctl->cache_fd = fd;
+}
 
- restart:
-	memset(&rcvbuf, -1, sizeof(rcvbuf));
-	msg = reset;
+/* The entry of the target, a new one in place of the oldest if create. */
+static struct path_entry *cache_entry(struct run_state *const ctl, int create)
+{
+	struct path_entry *oldest = NULL;
+	int family = ctl->target.ss_family;
+	uint8_t key[16];
+	uint32_t h;
+	int i;
 
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-	recv_size = recvmsg(ctl->socket_fd, &msg, MSG_ERRQUEUE);
-	if (recv_size < 0) {
-		if (errno == EAGAIN)
-			return progress;
-		goto restart;
+	addr_key((struct sockaddr *)&ctl->target, key);
+	h = key_hash(key, family) % CACHE_SLOTS;
+	for (i = 0; i < CACHE_PROBE; i++) {
+		struct path_entry *pe = &ctl->cache->entry[(h + i) % CACHE_SLOTS];
+
+		if (pe->updated && pe->family == family && !memcmp(pe->dst, key, sizeof(key)))
+			return pe;
+		if (!oldest || pe->updated < oldest->updated)
+			oldest = pe;
 	}
+	if (!create)
+		return NULL;
+	memset(oldest, 0, sizeof(*oldest));
+	oldest->family = family;
+	memcpy(oldest->dst, key, sizeof(key));
+	return oldest;
+}
 
-	progress = ctl->mtu;
+static int hop_cached(struct path_entry const *const pe, int ttl)
+{
+	static const uint8_t none[16];
 
-	rethops = -1;
-	sndhops = -1;
-	e = NULL;
-	retts = NULL;
-	broken_router = 0;
+	return memcmp(pe->hop[ttl - 1], none, sizeof(none)) != 0;
+}
 
-	slot = -ctl->base_port;
-	switch (ctl->ai->ai_family) {
-	case AF_INET6:
-		slot += ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
-		break;
-	case AF_INET:
-		slot += ntohs(((struct sockaddr_in *)&addr)->sin_port);
-		break;
-	}
-	if (slot >= 0 && slot < (HIS_ARRAY_SIZE - 1) && ctl->his[slot].hops) {
-		sndhops = ctl->his[slot].hops;
-		retts = &ctl->his[slot].sendtime;
-		ctl->his[slot].hops = 0;
-	}
-	if (recv_size == sizeof(rcvbuf)) {
-		if (rcvbuf.ttl == 0 || (rcvbuf.ts.tv_sec == 0 && rcvbuf.ts.tv_nsec == 0))
-			broken_router = 1;
-		else {
-			sndhops = rcvbuf.ttl;
-			retts = &rcvbuf.ts;
-		}
-	}
+static void cached_addr(struct path_entry const *const pe, int ttl, struct sockaddr_storage *ss)
+{
+	memset(ss, 0, sizeof(*ss));
+	ss->ss_family = pe->hop_family;
+	if (pe->hop_family == AF_INET6)
+		memcpy(&((struct sockaddr_in6 *)ss)->sin6_addr, pe->hop[ttl - 1], 16);
+	else
+		memcpy(&((struct sockaddr_in *)ss)->sin_addr, pe->hop[ttl - 1], 4);
+}
 
-	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-		switch (cmsg->cmsg_level) {
-		case SOL_IPV6:
-			switch (cmsg->cmsg_type) {
-			case IPV6_RECVERR:
-				e = (struct sock_extended_err *)CMSG_DATA(cmsg);
-				break;
-			case IPV6_HOPLIMIT:
-#ifdef IPV6_2292HOPLIMIT
-			case IPV6_2292HOPLIMIT:
-#endif
-				memcpy(&rethops, CMSG_DATA(cmsg), sizeof(rethops));
-				break;
-			default:
-				printf(_("cmsg6:%d\n "), cmsg->cmsg_type);
-			}
-			break;
-		case SOL_IP:
-			switch (cmsg->cmsg_type) {
-			case IP_RECVERR:
-				e = (struct sock_extended_err *)CMSG_DATA(cmsg);
-				break;
-			case IP_TTL:
-				rethops = *(uint8_t *)CMSG_DATA(cmsg);
-				break;
-			default:
-				printf(_("cmsg4:%d\n "), cmsg->cmsg_type);
-			}
-		}
-	}
-	if (e == NULL) {
-		printf(_("no info\n"));
-		return 0;
-	}
-	if (e->ee_origin == SO_EE_ORIGIN_LOCAL)
-		printf("%2d?: %-32s ", ctl->ttl, _("[LOCALHOST]"));
-	else if (e->ee_origin == SO_EE_ORIGIN_ICMP6 ||
-		 e->ee_origin == SO_EE_ORIGIN_ICMP) {
-		char abuf[NI_MAXHOST];
-		struct sockaddr *sa = (struct sockaddr *)(e + 1);
-		socklen_t salen;
+/* Whether a hop answered as it did last time, or kept silent again. */
+static int hop_unchanged(struct run_state const *const ctl, struct path_entry const *const pe,
+			 int ttl)
+{
+	struct hop const *hop = &ctl->hop[ttl];
+	uint8_t key[16];
 
-		if (sndhops > 0)
-			printf("%2d:  ", sndhops);
-		else
-			printf("%2d?: ", ctl->ttl);
+	if (!hop->from.ss_family)
+		return !hop_cached(pe, ttl);
+	addr_key((struct sockaddr const *)&hop->from, key);
+	return hop->from.ss_family == pe->hop_family && !memcmp(key, pe->hop[ttl - 1], sizeof(key));
+}
 
-		switch (sa->sa_family) {
-		case AF_INET6:
-			salen = sizeof(struct sockaddr_in6);
-			break;
-		case AF_INET:
-			salen = sizeof(struct sockaddr_in);
-			break;
-		default:
-			salen = 0;
-		}
+/* Keep a path that reached the destination for the next trace. */
+static void cache_update(struct run_state *const ctl)
+{
+	struct path_entry *pe;
+	int end = ctl->hops_to;
+	int ttl;
+
+	if (end < 1 || end > CACHE_HOPS || !ctl->hop[end].final)
+		return;
+	flock(ctl->cache_fd, LOCK_EX);
+	pe = cache_entry(ctl, 1);
+	memset(pe->hop, 0, sizeof(pe->hop));
+	pe->nhops = end;
+	for (ttl = 1; ttl <= end; ttl++) {
+		struct sockaddr const *sa = (struct sockaddr const *)&ctl->hop[ttl].from;
+
+		if (!sa->sa_family)
+			continue;
+		pe->hop_family = sa->sa_family;
+		addr_key(sa, pe->hop[ttl - 1]);
+	}
+	pe->updated = time(NULL);
+	flock(ctl->cache_fd, LOCK_UN);
+}
 
-		if (ctl->no_resolve || ctl->show_both) {
-			if (getnameinfo(sa, salen, abuf, sizeof(abuf), NULL, 0,
-					NI_NUMERICHOST))
-				strcpy(abuf, "???");
-		} else
-			abuf[0] = 0;
+/* Probe the hops in ttls[] all at once, until each is answered or given up. */
+static void probe_hops(struct run_state *const ctl, int const *ttls, int n)
+{
+	struct pollfd pfd = {
+		.fd = ctl->socket_fd,
+		.events = POLLIN | POLLERR
+	};
+	int i;
 
-		if (!ctl->no_resolve || ctl->show_both) {
-			fflush(stdout);
-			if (getnameinfo(sa, salen, hnamebuf, sizeof hnamebuf, NULL, 0,
-					getnameinfo_flags))
-				strcpy(hnamebuf, "???");
-		} else
-			hnamebuf[0] = 0;
+	ctl->last_ttl = ctl->max_hops;
+	for (i = 0; i < n; i++)
+		probe_ttl(ctl, ttls[i]);
+	while (1) {
+		struct timespec now;
+		int timeout = -1;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for (i = 0; i < n; i++)
+			hop_tick(ctl, ttls[i], &now, &timeout);
+		if (timeout < 0)
+			return;
+		if (poll(&pfd, 1, timeout) <= 0)
+			continue;
+		if (pfd.revents & POLLERR)
+			recverr(ctl);
+		if (pfd.revents & POLLIN)
+			recv(ctl->socket_fd, ctl->pktbuf, ctl->mtu, MSG_DONTWAIT);
+	}
+}
 
-		if (ctl->no_resolve)
-			print_host(ctl, abuf, hnamebuf);
-		else
-			print_host(ctl, hnamebuf, abuf);
+/*
+ * Trace a path known from the cache.  It is checked at a few hops spread
+ * over it at once, and probed hop by hop again only past the last of them
+ * that still answers as before.  Returns 1 when the path ended before
+ * max_hops.
+ */
+static int retrace(struct run_state *const ctl)
+{
+	struct path_entry cached;
+	struct path_entry *pe;
+	int samples[CACHE_SAMPLES];
+	int nsamples = 0;
+	int first = 1;
+	int ended;
+	int ttl;
+	int i;
+
+	flock(ctl->cache_fd, LOCK_SH);
+	pe = cache_entry(ctl, 0);
+	if (pe)
+		cached = *pe;
+	flock(ctl->cache_fd, LOCK_UN);
+	if (!pe || cached.nhops > ctl->max_hops) {
+		ended = trace(ctl, 1, ctl->max_hops);
+		cache_update(ctl);
+		return ended;
 	}
 
-	if (retts) {
-		struct timespec res;
+	/* Evenly spread, on hops that answered last time where possible. */
+	for (i = 1; i <= CACHE_SAMPLES; i++) {
+		int t = (cached.nhops * i + CACHE_SAMPLES - 1) / CACHE_SAMPLES;
 
-		timespecsub(&ts, retts, &res);
-		printf(_("%3ld.%03ldms "), res.tv_sec * 1000 + res.tv_nsec / 1000000,
-					   (res.tv_nsec % 1000000) / 1000);
-		if (broken_router)
-			printf(_("(This broken router returned corrupted payload) "));
+		while (t > 1 && !hop_cached(&cached, t))
+			t--;
+		if (!nsamples || t > samples[nsamples - 1])
+			samples[nsamples++] = t;
 	}
+	probe_hops(ctl, samples, nsamples);
+	for (i = 0; i < nsamples && hop_unchanged(ctl, &cached, samples[i]); i++)
+		first = samples[i] + 1;
 
-	if (rethops <= 64)
-		rethops = 65 - rethops;
-	else if (rethops <= 128)
-		rethops = 129 - rethops;
-	else
-		rethops = 256 - rethops;
+	/* The hops before are taken from the cache. */
+	for (ttl = 1; ttl < first; ttl++) {
+		struct hop *hop = &ctl->hop[ttl];
 
-	switch (e->ee_errno) {
-	case ETIMEDOUT:
-		printf("\n");
-		break;
-	case EMSGSIZE:
-		printf(_("pmtu %d\n"), e->ee_info);
-		ctl->mtu = e->ee_info;
-		progress = ctl->mtu;
-		break;
-	case ECONNREFUSED:
-		printf(_("reached\n"));
-		ctl->hops_to = sndhops < 0 ? ctl->ttl : sndhops;
-		ctl->hops_from = rethops;
-		return 0;
-	case EPROTO:
-		printf("!P\n");
-		return 0;
-	case EHOSTUNREACH:
-		if ((e->ee_origin == SO_EE_ORIGIN_ICMP &&
-		     e->ee_type == ICMP_TIME_EXCEEDED &&
-		     e->ee_code == ICMP_EXC_TTL) ||
-		    (e->ee_origin == SO_EE_ORIGIN_ICMP6 &&
-		     e->ee_type == ICMPV6_TIME_EXCEED &&
-		     e->ee_code == ICMPV6_EXC_HOPLIMIT)) {
-			if (rethops >= 0) {
-				if ((sndhops >= 0 && rethops != sndhops) ||
-					(sndhops < 0 && rethops != ctl->ttl))
-					printf(_("asymm %2d "), rethops);
+		if (hop->done)
+			continue;
+		if (hop_cached(&cached, ttl)) {
+			cached_addr(&cached, ttl, &hop->from);
+			hop_printf(ctl, ttl, "%2d:  ", ttl);
+			hop_host(ctl, ttl, (struct sockaddr *)&hop->from);
+			hop_printf(ctl, ttl, _("cached\n"));
+		} else
+			hop_printf(ctl, ttl, _("%2d:  no reply, cached\n"), ttl);
+		hop_done(ctl, ttl, 0);
+	}
+	print_hops(ctl, 1, first - 1);
+	if (i == nsamples) {
+		ended = 1;
+		printf(_("     Cache: path unchanged at %d sampled hops\n"), nsamples);
+	} else {
+		/* Not past a sample that reached the destination already. */
+		ended = trace(ctl, first, ctl->last_ttl);
+		printf(_("     Cache: path changed after hop %d\n"), first - 1);
+	}
+	cache_update(ctl);
+	return ended;
+}
+
+/*
+ * Continuous mode: probe every hop of the path once per interval and keep
+ * per-hop statistics, printed as a table after every round on a terminal
+ * and every REPORT_ROUNDS rounds otherwise.
+ */
+static void monitor(struct run_state *const ctl)
+{
+	struct pollfd pfd = {
+		.fd = ctl->socket_fd,
+		.events = POLLIN | POLLERR
+	};
+	struct sigaction sa = {
+		.sa_handler = sigexit
+	};
+	struct timespec next_round;
+	int redraw = isatty(STDOUT_FILENO);
+	long round = 0;
+	int ttl;
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	for (ttl = 0; ttl <= ctl->max_hops; ttl++)
+		hop_reset_stats(&ctl->hop[ttl]);
+	ctl->last_ttl = ctl->max_hops;
+	clock_gettime(CLOCK_MONOTONIC, &next_round);
+
+	while (!exiting) {
+		struct timespec now;
+		long timeout;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timeout = expire_probes(ctl, &now);
+		if (!ctl->rounds || round < ctl->rounds) {
+			long ms = timespec_diff_ms(&next_round, &now);
+
+			if (ms <= 0) {
+				if (round && (redraw || round % REPORT_ROUNDS == 0))
+					print_table(ctl, round, redraw);
+				for (ttl = 1; ttl <= ctl->last_ttl; ttl++)
+					probe_ttl(ctl, ttl);
+				round++;
+				/* Do not make up for a stall with a burst of rounds. */
+				if (ms < -ctl->interval_ms)
+					next_round = now;
+				timespec_add_ms(&next_round, ctl->interval_ms);
+				continue;
 			}
-			printf("\n");
+			if (timeout < 0 || ms < timeout)
+				timeout = ms;
+		} else if (timeout < 0)
 			break;
-		}
-		printf("!H\n");
-		return 0;
-	case ENETUNREACH:
-		printf("!N\n");
-		return 0;
-	case EACCES:
-		printf("!A\n");
-		return 0;
-	default:
-		printf("\n");
-		error(0, e->ee_errno, _("NET ERROR"));
-		return 0;
+
+		if (poll(&pfd, 1, timeout) <= 0)
+			continue;
+		if (pfd.revents & POLLERR)
+			recverr(ctl);
+		if (pfd.revents & POLLIN)
+			while (recv(ctl->socket_fd, ctl->pktbuf, ctl->mtu, MSG_DONTWAIT) > 0)
+				;
 	}
-	goto restart;
+	print_table(ctl, round, redraw);
 }
 
-static int probe_ttl(struct run_state *const ctl)
+/* Seconds, possibly fractional, to msecs. */
+static long parse_msecs(char const *const str, long min_ms)
 {
-	int i;
-	struct probehdr *hdr = ctl->pktbuf;
+	char *end;
+	double sec;
+
+	errno = 0;
+	sec = strtod(str, &end);
+	if (errno || end == str || *end || sec * 1000 < min_ms || sec > INT_MAX / 1000)
+		error(1, 0, _("invalid time: %s, at least %ld ms"), str, min_ms);
+	return sec * 1000;
+}
 
-	memset(ctl->pktbuf, 0, ctl->mtu);
- restart:
-	for (i = 0; i < MAX_PROBES; i++) {
-		int res;
+/* The mtu metric of a route, which is also where a cached pmtu shows. */
+static int route_metrics_mtu(struct rtattr *ra)
+{
+	struct rtattr *m;
+	size_t len = RTA_PAYLOAD(ra);
+	uint32_t mtu;
 
-		hdr->ttl = ctl->ttl;
-		switch (ctl->ai->ai_family) {
-		case AF_INET6:
-			((struct sockaddr_in6 *)&ctl->target)->sin6_port =
-			    htons(ctl->base_port + ctl->hisptr);
-			break;
-		case AF_INET:
-			((struct sockaddr_in *)&ctl->target)->sin_port =
-			    htons(ctl->base_port + ctl->hisptr);
-			break;
-		}
-		clock_gettime(CLOCK_MONOTONIC, &hdr->ts);
-		ctl->his[ctl->hisptr].hops = ctl->ttl;
-		ctl->his[ctl->hisptr].sendtime = hdr->ts;
-		if (sendto(ctl->socket_fd, ctl->pktbuf, ctl->mtu - ctl->overhead, 0,
-			   (struct sockaddr *)&ctl->target, ctl->targetlen) > 0)
-			break;
-		res = recverr(ctl);
-		ctl->his[ctl->hisptr].hops = 0;
-		if (res == 0)
-			return 0;
-		if (res > 0)
-			goto restart;
+	for (m = RTA_DATA(ra); RTA_OK(m, (unsigned short)len); m = RTA_NEXT(m, len)) {
+		if (m->rta_type != RTAX_MTU)
+			continue;
+		memcpy(&mtu, RTA_DATA(m), sizeof(mtu));
+		return mtu;
 	}
-	ctl->hisptr = (ctl->hisptr + 1) & (HIS_ARRAY_SIZE - 1);
+	return 0;
+}
 
-	if (i < MAX_PROBES) {
-		data_wait(ctl);
-		if (recv(ctl->socket_fd, ctl->pktbuf, ctl->mtu, MSG_DONTWAIT) > 0) {
-			printf(_("%2d?: reply received 8)\n"), ctl->ttl);
-			return 0;
+/*
+ * Ask rtnetlink for the route to the target, and start from its mtu
+ * instead of the largest possible one: from the mtu metric or cached pmtu
+ * of the route if it has one, otherwise from its outgoing interface.  The
+ * first probes then already have the right size.  Returns 0 if unknown.
+ */
+static int route_mtu(struct run_state const *const ctl)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct rtmsg rm;
+		char attrs[RTA_SPACE(16)];
+	} req;
+	struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+	char buf[4096];
+	struct nlmsghdr *nh;
+	struct rtattr *ra;
+	struct ifreq ifr;
+	ssize_t len;
+	size_t alen;
+	int oif = 0;
+	int mtu = 0;
+	int fd;
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_type = RTM_GETROUTE;
+	req.nh.nlmsg_flags = NLM_F_REQUEST;
+	req.nh.nlmsg_seq = 1;
+	ra = (struct rtattr *)req.attrs;
+	ra->rta_type = RTA_DST;
+	if (ctl->ai->ai_family == AF_INET6 && !ctl->mapped) {
+		req.rm.rtm_family = AF_INET6;
+		alen = 16;
+		memcpy(RTA_DATA(ra), &((struct sockaddr_in6 *)&ctl->target)->sin6_addr, alen);
+	} else {
+		req.rm.rtm_family = AF_INET;
+		alen = 4;
+		if (ctl->mapped)
+			memcpy(RTA_DATA(ra), &((struct sockaddr_in6 *)&ctl->target)->sin6_addr.s6_addr[12], alen);
+		else
+			memcpy(RTA_DATA(ra), &((struct sockaddr_in *)&ctl->target)->sin_addr, alen);
+	}
+	req.rm.rtm_dst_len = alen * 8;
+	ra->rta_len = RTA_LENGTH(alen);
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.rm)) + RTA_SPACE(alen);
+
+	fd = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0)
+		return 0;
+	if (sendto(fd, &req, req.nh.nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		close(fd);
+		return 0;
+	}
+	do {
+		len = recv(fd, buf, sizeof(buf), 0);
+	} while (len < 0 && errno == EINTR);
+	close(fd);
+
+	for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+		struct rtmsg *rm = NLMSG_DATA(nh);
+		size_t rlen = RTM_PAYLOAD(nh);
+
+		if (nh->nlmsg_type != RTM_NEWROUTE)
+			continue;
+		for (ra = RTM_RTA(rm); RTA_OK(ra, (unsigned short)rlen); ra = RTA_NEXT(ra, rlen)) {
+			if (ra->rta_type == RTA_OIF)
+				memcpy(&oif, RTA_DATA(ra), sizeof(oif));
+			else if (ra->rta_type == RTA_METRICS)
+				mtu = route_metrics_mtu(ra);
 		}
-		return recverr(ctl);
 	}
+	if (mtu || !oif)
+		return mtu;
 
-	printf(_("%2d:  send failed\n"), ctl->ttl);
-	return 0;
+	memset(&ifr, 0, sizeof(ifr));
+	if (!if_indextoname(oif, ifr.ifr_name) ||
+	    ioctl(ctl->socket_fd, SIOCGIFMTU, &ifr) < 0)
+		return 0;
+	return ifr.ifr_mtu;
 }
 
 static void usage(void)
@@ -399,15 +2682,27 @@ static void usage(void)
 	fprintf(stderr, _(
 		"\nUsage\n"
 		"  tracepath [options] <destination>\n"
+		"  tracepath [options] -D <file>\n"
 		"\nOptions:\n"
 		"  -4             use IPv4\n"
 		"  -6             use IPv6\n"
 		"  -b             print both name and IP\n"
+		"  -c <count>     stop after <count> rounds of continuous mode\n"
+		"  -C <interval>  probe the path continuously every <interval> seconds\n"
+		"  -D <file>      trace all the destinations listed in <file>\n"
+		"  -f <ttl>       start multi-destination traces at hop <ttl>\n"
+		"  -F             keep the flow of all probes the same\n"
+		"  -G <file>      label hops by the longest matching prefix in <file>\n"
 		"  -l <length>    use packet <length>\n"
 		"  -m <hops>      use maximum <hops>\n"
+		"  -M <percent>   find all load balanced paths with <percent> confidence\n"
 		"  -n             no reverse DNS name resolution\n"
+		"  -N <hops>      probe up to <hops> hops at once\n"
 		"  -p <port>      use destination <port>\n"
+		"  -P             search the pmtu with probes of different sizes\n"
+		"  -R <file>      check the path cached in <file> first, and keep it there\n"
 		"  -V             print version and exit\n"
+		"  -W <timeout>   wait at most <timeout> seconds for a reply\n"
 		"  <destination>  DNS name or IP address\n"
 		"\nFor more details see tracepath(8).\n"));
 	exit(-1);
@@ -419,6 +2714,8 @@ int main(int argc, char **argv)
 		.max_hops = MAX_HOPS_DEFAULT,
 		.hops_to = -1,
 		.hops_from = -1,
+		.window = WINDOW_DEFAULT,
+		.max_timeout_ms = TIMEOUT_MAX_DEFAULT_MS,
 		0
 	};
 	struct addrinfo hints = {
@@ -433,6 +2730,11 @@ int main(int argc, char **argv)
 	int ch;
 	int status;
 	int on;
+	int default_mtu = 0;
+	int route_mtu_known = 0;
+	char const *dest_file = NULL;
+	char const *cache_file = NULL;
+	char *dest;
 	char *p;
 	char pbuf[NI_MAXSERV];
 
@@ -451,7 +2753,7 @@ int main(int argc, char **argv)
 	else if (argv[0][strlen(argv[0]) - 1] == '6')
 		hints.ai_family = AF_INET6;
 
-	while ((ch = getopt(argc, argv, "46nbh?l:m:p:V")) != EOF) {
+	while ((ch = getopt(argc, argv, "46nbc:C:D:f:FG:h?l:m:M:N:p:PR:VW:")) != EOF) {
 		switch (ch) {
 		case '4':
 			if (hints.ai_family == AF_INET6)
@@ -469,15 +2771,56 @@ int main(int argc, char **argv)
 		case 'b':
 			ctl.show_both = 1;
 			break;
+		case 'c':
+			ctl.rounds = strtol_or_err(optarg, _("invalid argument"), 1, LONG_MAX);
+			if (!ctl.continuous)
+				ctl.interval_ms = 1000;
+			ctl.continuous = 1;
+			break;
+		case 'C':
+			ctl.interval_ms = parse_msecs(optarg, INTERVAL_MIN_MS);
+			ctl.continuous = 1;
+			break;
+		case 'D':
+			ctl.doubletree = 1;
+			dest_file = optarg;
+			break;
+		case 'f':
+			ctl.dt.first_ttl = strtol_or_err(optarg, _("invalid argument"), 1, MAX_HOPS_LIMIT);
+			break;
+		case 'G':
+			ctl.prefixes = lpm_load(optarg);
+			break;
+		case 'F':
+			ctl.flow_stable = 1;
+			break;
 		case 'l':
 			ctl.mtu = strtol_or_err(optarg, _("invalid argument"), ctl.overhead, INT_MAX);
 			break;
 		case 'm':
 			ctl.max_hops = strtol_or_err(optarg, _("invalid argument"), 0, MAX_HOPS_LIMIT);
 			break;
+		case 'M':
+			ctl.confidence = strtol_or_err(optarg, _("invalid argument"), 50, 99);
+			ctl.multipath = 1;
+			break;
+		case 'N':
+			ctl.window = strtol_or_err(optarg, _("invalid argument"), 1, WINDOW_LIMIT);
+			break;
+		case 'P':
+			ctl.plpmtud = 1;
+			/* All sizes should take the same path. */
+			ctl.flow_stable = 1;
+			break;
+		case 'R':
+			cache_file = optarg;
+			break;
 		case 'p':
 			ctl.base_port = strtol_or_err(optarg, _("invalid argument"), 0, UINT16_MAX);
 			break;
+		case 'W':
+			ctl.max_timeout_ms = parse_msecs(optarg, TIMEOUT_MIN_MS);
+			break;
 		case 'V':
 			printf(IPUTILS_VERSION("tracepath"));
 			print_config();
@@ -490,23 +2833,47 @@ int main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (argc != 1)
+	if (argc != !ctl.doubletree)
 		usage();
+	if (ctl.doubletree && (ctl.continuous || ctl.multipath || ctl.plpmtud))
+		error(2, 0, _("-D cannot be used with continuous, multipath or pmtu search mode"));
+	if (cache_file && (ctl.continuous || ctl.multipath || ctl.plpmtud || ctl.doubletree))
+		error(2, 0, _("-R cannot be used with continuous, multipath, pmtu search or multi-destination mode"));
+	if (cache_file)
+		cache_open(&ctl, cache_file);
+	if (ctl.doubletree) {
+		dt_read(&ctl, dest_file);
+		if (!ctl.dt.first_ttl)
+			ctl.dt.first_ttl = DT_FIRST_TTL_DEFAULT;
+		/* The first one picks the address family. */
+		dest = ctl.dt.dests[0];
+	} else
+		dest = argv[0];
+	if (ctl.multipath && ctl.continuous)
+		error(2, 0, _("-M cannot be used with continuous mode"));
+	/* Before -F, which -P implies. */
+	if (ctl.plpmtud && (ctl.continuous || ctl.multipath))
+		error(2, 0, _("-P cannot be used with continuous or multipath mode"));
+	if (ctl.multipath && ctl.flow_stable)
+		error(2, 0, _("-F and -M cannot be used together"));
 
 	/* Backward compatibility */
 	if (!ctl.base_port) {
-		p = strchr(argv[0], '/');
+		p = ctl.doubletree ? NULL : strchr(dest, '/');
 		if (p) {
 			*p = 0;
 			ctl.base_port = strtol_or_err(p + 1, _("invalid argument"), 0, UINT16_MAX);
 		} else
 			ctl.base_port = DEFAULT_BASEPORT;
 	}
+	if (ctl.multipath && ctl.base_port > UINT16_MAX - MDA_MAX_FLOWS + 1)
+		error(2, 0, _("-M needs %d ports from %u on"), MDA_MAX_FLOWS, ctl.base_port);
 	sprintf(pbuf, "%u", ctl.base_port);
+	names_init(&ctl);
 
-	status = getaddrinfo(argv[0], pbuf, &hints, &result);
+	status = getaddrinfo(dest, pbuf, &hints, &result);
 	if (status || !result) {
-		error(1, 0, "%s: %s", argv[0], gai_strerror(status));
+		error(1, 0, "%s: %s", dest, gai_strerror(status));
 		abort();
 	}
 
@@ -527,9 +2894,8 @@ int main(int argc, char **argv)
 	switch (ctl.ai->ai_family) {
 	case AF_INET6:
 		ctl.overhead = DEFAULT_OVERHEAD_IPV6;
-		if (!ctl.mtu)
-			ctl.mtu = DEFAULT_MTU_IPV6;
-		if (ctl.mtu <= ctl.overhead)
+		default_mtu = DEFAULT_MTU_IPV6;
+		if (ctl.mtu && ctl.mtu <= ctl.overhead)
 			goto pktlen_error;
 
 		on = IPV6_PMTUDISC_PROBE;
@@ -552,9 +2918,8 @@ int main(int argc, char **argv)
 		/*FALLTHROUGH*/
 	case AF_INET:
 		ctl.overhead = DEFAULT_OVERHEAD_IPV4;
-		if (!ctl.mtu)
-			ctl.mtu = DEFAULT_MTU_IPV4;
-		if (ctl.mtu <= ctl.overhead)
+		default_mtu = DEFAULT_MTU_IPV4;
+		if (ctl.mtu && ctl.mtu <= ctl.overhead)
 			goto pktlen_error;
 
 		on = IP_PMTUDISC_PROBE;
@@ -567,55 +2932,63 @@ int main(int argc, char **argv)
 			error(1, errno, "IP_RECVTTL");
 	}
 
+	if (!ctl.mtu) {
+		ctl.mtu = route_mtu(&ctl);
+		if (ctl.mtu <= ctl.overhead)
+			ctl.mtu = default_mtu;
+		else
+			route_mtu_known = 1;
+		/* Such as the 65536 of lo, more than a datagram holds. */
+		if (ctl.mtu > default_mtu)
+			ctl.mtu = default_mtu;
+	}
+
 	ctl.pktbuf = malloc(ctl.mtu);
 	if (!ctl.pktbuf)
 		error(1, errno, "malloc");
 
-	for (ctl.ttl = 1; ctl.ttl <= ctl.max_hops; ctl.ttl++) {
-		int res = -1;
-		int i;
-
-		on = ctl.ttl;
-		switch (ctl.ai->ai_family) {
-		case AF_INET6:
-			if (setsockopt(ctl.socket_fd, SOL_IPV6, IPV6_UNICAST_HOPS, &on, sizeof(on)))
-				error(1, errno, "IPV6_UNICAST_HOPS");
-			if (!ctl.mapped)
-				break;
-			/*FALLTHROUGH*/
-		case AF_INET:
-			if (setsockopt(ctl.socket_fd, SOL_IP, IP_TTL, &on, sizeof(on)))
-				error(1, errno, "IP_TTL");
-		}
-
- restart:
-		for (i = 0; i < 3; i++) {
-			int old_mtu;
-
-			old_mtu = ctl.mtu;
-			res = probe_ttl(&ctl);
-			if (ctl.mtu != old_mtu)
-				goto restart;
-			if (res == 0)
-				goto done;
-			if (res > 0)
-				break;
-		}
-
-		if (res < 0)
-			printf(_("%2d:  no reply\n"), ctl.ttl);
+	memset(ctl.pktbuf, 0, ctl.mtu);
+	ctl.hop = calloc(ctl.max_hops + 1, sizeof(*ctl.hop));
+	if (!ctl.hop)
+		error(1, errno, "calloc");
+	/*
+	 * In continuous mode every hop has a probe in flight for each round
+	 * started within the longest timeout, the ring must hold them all.
+	 */
+	ctl.his_size = HIS_ARRAY_SIZE;
+	if (ctl.continuous) {
+		long inflight = ctl.max_hops * (ctl.max_timeout_ms / ctl.interval_ms + 2);
+
+		while (ctl.his_size < inflight && ctl.his_size < HIS_ARRAY_LIMIT)
+			ctl.his_size *= 2;
 	}
-	printf("     Too many hops: pmtu %d\n", ctl.mtu);
+	ctl.his = calloc(ctl.his_size, sizeof(*ctl.his));
+	if (!ctl.his)
+		error(1, errno, "calloc");
+	tx_stamps_on(&ctl);
+	/* Where the first pmtu report used to come from. */
+	if (route_mtu_known && ctl.max_hops > 0)
+		hop_printf(&ctl, 1, "%2d?: %-32s pmtu %d\n", 1, _("[LOCALHOST]"), ctl.mtu);
+
+	if (ctl.continuous)
+		monitor(&ctl);
+	else if (ctl.doubletree)
+		doubletree(&ctl);
+	else if (ctl.plpmtud)
+		pmtu_search(&ctl);
+	else if (!(ctl.multipath ? multipath(&ctl) :
+		   ctl.cache ? retrace(&ctl) : trace(&ctl, 1, ctl.max_hops)))
+		printf("     Too many hops: pmtu %d\n", ctl.mtu);
 
- done:
 	freeaddrinfo(result);
 
-	printf(_("     Resume: pmtu %d "), ctl.mtu);
-	if (ctl.hops_to >= 0)
-		printf(_("hops %d "), ctl.hops_to);
-	if (ctl.hops_from >= 0)
-		printf(_("back %d "), ctl.hops_from);
-	printf("\n");
+	if (ctl.kernel_rtts || ctl.user_rtts)
+		printf(_("     Timestamps: %s\n"), ts_source(&ctl));
+	if (ctl.doubletree)
+		printf(_("     Probes: %ld for %d destinations, %ld hops skipped\n"),
+		       ctl.dt.probes, ctl.dt.ndests, ctl.dt.skipped);
+	else
+		print_resume(&ctl);
 	exit(0);
 
  pktlen_error: